@@ -95,39 +95,46 @@
 
 #include "gain_analysis.h"
 
-#define YULE_FILTER         filterYule
-#define BUTTER_FILTER       filterButter
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__)) && !defined(RG_NO_SIMD)
+    #define RG_SSE
+    #include <emmintrin.h>
+#endif
+
 #define RMS_PERCENTILE      0.95        // percentile which is louder than the proposed level
 #define RMS_WINDOW_TIME     (1./RMS_WINDOW) // 0.050 Time slice size [s]
 #define PINK_REF            64.82 //298640883795                              // calibration value
+#define DESIGN_POINTS       1024        // frequency grid for deriving filters of untabulated rates
+#define PI                  3.14159265358979323846
+#define SQRT2               1.41421356237309504880
 
 // what follows is a really lazy & cheap fix to allow more than one instance without rewriting
 // most of the old code. i feel ashamed. ~maep
 #define CTX         struct rg_state* ctx
 
-#define linprebuf   (ctx->linprebuf)
-#define linpre      (ctx->linpre)
-#define lstepbuf    (ctx->lstepbuf)
-#define lstep       (ctx->lstep)
-#define loutbuf     (ctx->loutbuf)
-#define lout        (ctx->lout)
-#define rinprebuf   (ctx->rinprebuf)
-#define rinpre      (ctx->rinpre)
-#define rstepbuf    (ctx->rstepbuf)
-#define rstep       (ctx->rstep)
-#define routbuf     (ctx->routbuf)
-#define rout        (ctx->rout)
+#define inbuf       (ctx->inbuf)
+#define stepbuf     (ctx->stepbuf)
+#define outbuf      (ctx->outbuf)
 #define sampleWindow (ctx->sampleWindow)
 #define totsamp     (ctx->totsamp)
 #define lsum        (ctx->lsum)
 #define rsum        (ctx->rsum)
 #define freqindex   (ctx->freqindex)
+#define yulekernel  (ctx->yulekernel)
+#define butterkernel (ctx->butterkernel)
 #define first       (ctx->first)
 #define AA          (ctx->A)
 #define BB          (ctx->B)
 
-// for each filter:
-// [0] 48 kHz, [1] 44.1 kHz, [2] 32 kHz, [3] 24 kHz, [4] 22050 Hz, [5] 16 kHz, [6] 12 kHz, [7] is 11025 Hz, [8] 8 kHz
+// for each filter, same order as FreqTable:
+// [0] 96 kHz, [1] 88.2 kHz, [2] 64 kHz, [3] 48 kHz, [4] 44.1 kHz, [5] 32 kHz, [6] 24 kHz,
+// [7] 22050 Hz, [8] 16 kHz, [9] 12 kHz, [10] 11025 Hz, [11] 8 kHz
+
+static const long FreqTable[12] = {
+    96000, 88200, 64000, 48000, 44100, 32000, 24000, 22050, 16000, 12000, 11025, 8000
+};
+
+// the 88.2 kHz rows are damaged (unstable yule, butter a2 copied from 64 kHz), that rate is derived
+#define BAD_ROW     1
 
 #ifdef WIN32
 #ifndef __GNUC__
@@ -174,56 +181,296 @@ static const Float_t ABButter[12][2*BUTTER_ORDER + 1] = {
 
 // When calling these filter procedures, make sure that ip[-order] and op[-order] point to real data!
 
-// If your compiler complains that "'operation on 'output' may be undefined", you can
-// either ignore the warnings or uncomment the three "y" lines (and comment out the indicated line)
+// Both channels run through the same filters, so the buffers hold interleaved stereo frames
+// and the SIMD version processes left and right in two lanes of one register. Yule and
+// Butterworth stage as well as the squaring are done in one pass. The operations per lane
+// happen in the same order as in the scalar version, so both give the same results.
+
+#define Y(i, k)     - st [-2*(i)] * yule[k - 1]  + in[-2*(i)] * yule[k]
+#define YULE(k)     (1e-10 /* 1e-10 is a hack to avoid slowdown because of denormals */ \
+                     + in[0] * yule[0] Y(1, 2) Y(2, 4) Y(3, 6) Y(4, 8) Y(5, 10)           \
+                     Y(6, 12) Y(7, 14) Y(8, 16) Y(9, 18) Y(10, 20))
 
 static void
-filterYule (const Float_t* input, Float_t* output, size_t nSamples, const Float_t* kernel)
+filterStereo (const Float_t* input, Float_t* step, Float_t* output, size_t nSamples,
+              const Float_t* yule, const Float_t* butter, Float_t* sums)
 {
+    Float_t     lsq = 0.;
+    Float_t     rsq = 0.;
 
     while (nSamples--) {
-       *output =  1e-10  /* 1e-10 is a hack to avoid slowdown because of denormals */
-         + input [0]  * kernel[0]
-         - output[-1] * kernel[1]
-         + input [-1] * kernel[2]
-         - output[-2] * kernel[3]
-         + input [-2] * kernel[4]
-         - output[-3] * kernel[5]
-         + input [-3] * kernel[6]
-         - output[-4] * kernel[7]
-         + input [-4] * kernel[8]
-         - output[-5] * kernel[9]
-         + input [-5] * kernel[10]
-         - output[-6] * kernel[11]
-         + input [-6] * kernel[12]
-         - output[-7] * kernel[13]
-         + input [-7] * kernel[14]
-         - output[-8] * kernel[15]
-         + input [-8] * kernel[16]
-         - output[-9] * kernel[17]
-         + input [-9] * kernel[18]
-         - output[-10]* kernel[19]
-         + input [-10]* kernel[20];
-        ++output;
-        ++input;
+        const Float_t*  in;
+        Float_t*        st;
+        Float_t*        out;
+
+        in = input; st = step; out = output;
+        st [0] = YULE();
+        out[0] = st[0] * butter[0] - out[-2] * butter[1] + st[-2] * butter[2] - out[-4] * butter[3] + st[-4] * butter[4];
+        lsq   += out[0] * out[0];
+
+        in = input + 1; st = step + 1; out = output + 1;
+        st [0] = YULE();
+        out[0] = st[0] * butter[0] - out[-2] * butter[1] + st[-2] * butter[2] - out[-4] * butter[3] + st[-4] * butter[4];
+        rsq   += out[0] * out[0];
+
+        input  += 2;
+        step   += 2;
+        output += 2;
     }
+    sums[0] += lsq;
+    sums[1] += rsq;
 }
 
+#undef Y
+#undef YULE
+
+#ifdef RG_SSE
+
+// lanes 0 and 1 hold left and right. the yule sum is accumulated in double like the
+// scalar version does (the 1e-10 constant is a double)
+#define LOAD(p)         _mm_loadl_pi (zero, (const __m64*)(p))
+#define STORE(p, v)     _mm_storel_pi ((__m64*)(p), v)
+#define PROD(p, k)      _mm_cvtps_pd (_mm_mul_ps (LOAD(p), k))
+
+__attribute__((target("sse2")))
 static void
-filterButter ( const Float_t* input, Float_t* output, size_t nSamples, const Float_t* kernel)
+filterStereoSSE2 (const Float_t* in, Float_t* st, Float_t* out, size_t nSamples,
+                  const Float_t* yule, const Float_t* butter, Float_t* sums)
 {
+    const __m128    zero    = _mm_setzero_ps ();
+    const __m128d   denorm  = _mm_set1_pd (1e-10);
+    __m128          y [2*YULE_ORDER + 1];
+    __m128          b [2*BUTTER_ORDER + 1];
+    __m128          sq      = zero;
+    float           tmp [4];
+    int             i;
+
+    for ( i = 0; i < 2*YULE_ORDER + 1; i++ )
+        y[i] = _mm_set1_ps (yule[i]);
+    for ( i = 0; i < 2*BUTTER_ORDER + 1; i++ )
+        b[i] = _mm_set1_ps (butter[i]);
+
     while (nSamples--) {
-        *output =
-           input [0]  * kernel[0]
-         - output[-1] * kernel[1]
-         + input [-1] * kernel[2]
-         - output[-2] * kernel[3]
-         + input [-2] * kernel[4];
-        ++output;
-        ++input;
+        __m128d acc = _mm_add_pd (denorm, PROD(in, y[0]));
+        for ( i = 1; i <= YULE_ORDER; i++ ) {
+            acc = _mm_sub_pd (acc, PROD(st - 2*i, y[2*i - 1]));
+            acc = _mm_add_pd (acc, PROD(in - 2*i, y[2*i]));
+        }
+        __m128 s = _mm_cvtpd_ps (acc);
+        STORE(st, s);
+
+        __m128 o = _mm_mul_ps (s, b[0]);
+        o = _mm_sub_ps (o, _mm_mul_ps (LOAD(out - 2), b[1]));
+        o = _mm_add_ps (o, _mm_mul_ps (LOAD(st  - 2), b[2]));
+        o = _mm_sub_ps (o, _mm_mul_ps (LOAD(out - 4), b[3]));
+        o = _mm_add_ps (o, _mm_mul_ps (LOAD(st  - 4), b[4]));
+        STORE(out, o);
+
+        sq = _mm_add_ps (sq, _mm_mul_ps (o, o));
+        in  += 2;
+        st  += 2;
+        out += 2;
+    }
+    _mm_storeu_ps (tmp, sq);
+    sums[0] += tmp[0];
+    sums[1] += tmp[1];
+}
+
+#undef LOAD
+#undef STORE
+#undef PROD
+
+#endif
+
+static rg_filter_t
+selectFilter (void)
+{
+#ifdef RG_SSE
+    __builtin_cpu_init ();
+    if ( __builtin_cpu_supports ("sse2") )
+        return filterStereoSSE2;
+#endif
+    return filterStereo;
+}
+
+// Filters for samplerates that are not in the tables are derived at init. The Butterworth
+// stage is a plain 150 Hz high pass, so it is designed directly with the bilinear transform.
+// The Yule stage approximates an equal loudness curve that only exists as tabulated filters,
+// so the response of the closest tabulated filter with a higher rate is used as target. Its
+// minimum phase version is computed with the cepstrum method and then fitted with the
+// Steiglitz-McBride iteration (weighted equation error least squares).
+
+static double
+powerResponse (const Float_t* kernel, int order, double w)
+{
+    double  br = 0., bi = 0., ar = 0., ai = 0.;
+    int     i;
+
+    for ( i = 0; i <= order; i++ ) {
+        double b = kernel[2*i];
+        double a = i ? kernel[2*i-1] : 1.;
+        br += b * cos (i * w);
+        bi -= b * sin (i * w);
+        ar += a * cos (i * w);
+        ai -= a * sin (i * w);
+    }
+    return (br*br + bi*bi) / (ar*ar + ai*ai + 1.e-300);
+}
+
+static void
+designButter (Float_t* kernel, long samplefreq)
+{
+    double  k    = tan (PI * 150. / samplefreq);
+    double  norm = 1. / (1. + SQRT2 * k + k * k);
+
+    kernel[0] = (Float_t) norm;
+    kernel[1] = (Float_t) (2. * (k * k - 1.) * norm);
+    kernel[2] = (Float_t) (-2. * norm);
+    kernel[3] = (Float_t) ((1. - SQRT2 * k + k * k) * norm);
+    kernel[4] = (Float_t) norm;
+}
+
+// step-down recursion, all reflection coefficients must be inside the unit circle
+static int
+isStable (const double* a, int order)
+{
+    double  t [YULE_ORDER + 1];
+    double  u [YULE_ORDER + 1];
+    int     i, m;
+
+    memcpy ( t, a, (order + 1) * sizeof(double) );
+    for ( m = order; m >= 1; m-- ) {
+        double k = t[m];
+        if ( fabs (k) >= 1. )
+            return 0;
+        for ( i = 1; i < m; i++ )
+            u[i] = (t[i] - k * t[m - i]) / (1. - k * k);
+        memcpy ( t + 1, u + 1, (m - 1) * sizeof(double) );
     }
+    return 1;
 }
 
+#define UNKNOWNS    (2 * YULE_ORDER + 1)
+
+static int
+solve (double m[UNKNOWNS][UNKNOWNS + 1], double* x)
+{
+    int     r, c, j, pivot;
+
+    for ( c = 0; c < UNKNOWNS; c++ ) {
+        pivot = c;
+        for ( r = c + 1; r < UNKNOWNS; r++ )
+            if ( fabs (m[r][c]) > fabs (m[pivot][c]) )
+                pivot = r;
+        if ( fabs (m[pivot][c]) < 1.e-300 )
+            return 0;
+        for ( j = 0; j <= UNKNOWNS; j++ ) {
+            double tmp = m[c][j]; m[c][j] = m[pivot][j]; m[pivot][j] = tmp;
+        }
+        for ( r = 0; r < UNKNOWNS; r++ ) {
+            double f;
+            if ( r == c )
+                continue;
+            f = m[r][c] / m[c][c];
+            for ( j = c; j <= UNKNOWNS; j++ )
+                m[r][j] -= f * m[c][j];
+        }
+    }
+    for ( c = 0; c < UNKNOWNS; c++ )
+        x[c] = m[c][UNKNOWNS] / m[c][c];
+    return 1;
+}
+
+static int
+designYule (Float_t* kernel, long samplefreq)
+{
+    const int   n = DESIGN_POINTS;
+    double      lmag [DESIGN_POINTS / 2 + 1];
+    double      cep  [DESIGN_POINTS / 2 + 1];
+    double      hre  [DESIGN_POINTS / 2 + 1];
+    double      him  [DESIGN_POINTS / 2 + 1];
+    double      m    [UNKNOWNS][UNKNOWNS + 1];
+    double      x    [UNKNOWNS];
+    double      a    [YULE_ORDER + 1] = {1.};
+    double      b    [YULE_ORDER + 1] = {0.};
+    const Float_t* ref;
+    long        reffreq;
+    int         i, j, k, it;
+
+    // closest tabulated rate that covers the whole band
+    for ( i = 11; i > 0 && (FreqTable[i] < samplefreq || i == BAD_ROW); i-- )
+        ;
+    ref     = ABYule[i];
+    reffreq = FreqTable[i];
+
+    // log magnitude of the target, held constant above the reference band
+    for ( k = 0; k <= n / 2; k++ ) {
+        double f = (double)k / n * samplefreq;
+        if ( f > reffreq / 2. )
+            f = reffreq / 2.;
+        lmag[k] = 0.5 * log (powerResponse (ref, YULE_ORDER, 2. * PI * f / reffreq) + 1.e-12);
+    }
+
+    // real cepstrum, folded to get the minimum phase response
+    for ( j = 0; j <= n / 2; j++ ) {
+        double acc = 0.;
+        for ( k = 0; k < n; k++ )
+            acc += lmag[k <= n/2 ? k : n - k] * cos (2. * PI * k * j / n);
+        cep[j] = acc / n;
+    }
+    for ( k = 0; k <= n / 2; k++ ) {
+        double re = cep[0], im = 0.;
+        for ( j = 1; j <= n / 2; j++ ) {
+            double c = (j == n / 2 ? 1. : 2.) * cep[j];
+            re += c * cos (2. * PI * k * j / n);
+            im -= c * sin (2. * PI * k * j / n);
+        }
+        hre[k] = exp (re) * cos (im);
+        him[k] = exp (re) * sin (im);
+    }
+
+    // minimize sum |B - H * A|^2 / |A_prev|^2, unknowns are b0..b10, a1..a10
+    for ( it = 0; it < 20; it++ ) {
+        memset ( m, 0, sizeof(m) );
+        for ( k = 0; k <= n / 2; k++ ) {
+            double w  = PI * k / (n / 2);
+            double cr [UNKNOWNS];
+            double ci [UNKNOWNS];
+            double ar = 0., ai = 0., weight;
+            for ( i = 0; i <= YULE_ORDER; i++ ) {
+                ar += a[i] * cos (w * i);
+                ai -= a[i] * sin (w * i);
+                cr[i] =  cos (w * i);
+                ci[i] = -sin (w * i);
+            }
+            weight = 1. / (ar*ar + ai*ai);
+            for ( i = 1; i <= YULE_ORDER; i++ ) {
+                cr[YULE_ORDER + i] = -(hre[k] * cr[i] - him[k] * ci[i]);
+                ci[YULE_ORDER + i] = -(hre[k] * ci[i] + him[k] * cr[i]);
+            }
+            for ( i = 0; i < UNKNOWNS; i++ ) {
+                for ( j = 0; j < UNKNOWNS; j++ )
+                    m[i][j] += weight * (cr[i] * cr[j] + ci[i] * ci[j]);
+                m[i][UNKNOWNS] += weight * (cr[i] * hre[k] + ci[i] * him[k]);
+            }
+        }
+        if ( !solve (m, x) || !isStable (x + YULE_ORDER, YULE_ORDER) )
+            break;
+        for ( i = 0; i <= YULE_ORDER; i++ )
+            b[i] = x[i];
+        for ( i = 1; i <= YULE_ORDER; i++ )
+            a[i] = x[YULE_ORDER + i];
+    }
+    if ( it == 0 )
+        return INIT_GAIN_ANALYSIS_ERROR;
+
+    for ( i = 0; i <= YULE_ORDER; i++ ) {
+        kernel[2*i] = (Float_t) b[i];
+        if ( i )
+            kernel[2*i-1] = (Float_t) a[i];
+    }
+    return INIT_GAIN_ANALYSIS_OK;
+}
 
 // returns a INIT_GAIN_ANALYSIS_OK if successful, INIT_GAIN_ANALYSIS_ERROR if not
 
@@ -232,23 +479,23 @@ ResetSampleFrequency (CTX, long samplefreq) {
     int  i;
 
     // zero out initial values
-    for ( i = 0; i < MAX_ORDER; i++ )
-        linprebuf[i] = lstepbuf[i] = loutbuf[i] = rinprebuf[i] = rstepbuf[i] = routbuf[i] = 0.;
-
-    switch ( (int)(samplefreq) ) {
-        case 96000: freqindex = 0; break;
-        case 88200: freqindex = 1; break;
-        case 64000: freqindex = 2; break;
-        case 48000: freqindex = 3; break;
-        case 44100: freqindex = 4; break;
-        case 32000: freqindex = 5; break;
-        case 24000: freqindex = 6; break;
-        case 22050: freqindex = 7; break;
-        case 16000: freqindex = 8; break;
-        case 12000: freqindex = 9; break;
-        case 11025: freqindex = 10; break;
-        case  8000: freqindex = 11; break;
-        default:    return INIT_GAIN_ANALYSIS_ERROR;
+    for ( i = 0; i < MAX_ORDER * 2; i++ )
+        inbuf[i] = stepbuf[i] = outbuf[i] = 0.;
+
+    if ( samplefreq < 1000 || samplefreq > MAX_SAMP_FREQ )
+        return INIT_GAIN_ANALYSIS_ERROR;
+
+    for ( freqindex = 0; freqindex < 12 && (FreqTable[freqindex] != samplefreq || freqindex == BAD_ROW); freqindex++ )
+        ;
+
+    if ( freqindex < 12 ) {
+        memcpy ( yulekernel,   ABYule[freqindex],   sizeof(yulekernel) );
+        memcpy ( butterkernel, ABButter[freqindex], sizeof(butterkernel) );
+    }
+    else {
+        if ( designYule (yulekernel, samplefreq) != INIT_GAIN_ANALYSIS_OK )
+            return INIT_GAIN_ANALYSIS_ERROR;
+        designButter (butterkernel, samplefreq);
     }
 
     sampleWindow = (int) ceil (samplefreq * RMS_WINDOW_TIME);
@@ -269,12 +516,7 @@ InitGainAnalysis (CTX, long samplefreq)
         return INIT_GAIN_ANALYSIS_ERROR;
     }
 
-    linpre       = linprebuf + MAX_ORDER;
-    rinpre       = rinprebuf + MAX_ORDER;
-    lstep        = lstepbuf  + MAX_ORDER;
-    rstep        = rstepbuf  + MAX_ORDER;
-    lout         = loutbuf   + MAX_ORDER;
-    rout         = routbuf   + MAX_ORDER;
+    ctx->filter  = selectFilter ();
 
     memset ( BB, 0, sizeof(BB) );
 
@@ -283,19 +525,15 @@ InitGainAnalysis (CTX, long samplefreq)
 
 // returns GAIN_ANALYSIS_OK if successful, GAIN_ANALYSIS_ERROR if not
 
-static __inline Float_t fsqr(const Float_t d)
-{  return d*d;
-}
-
 int
 AnalyzeSamples (CTX, const Float_t* left_samples, const Float_t* right_samples, size_t num_samples, int num_channels )
 {
-    const Float_t*  curleft;
-    const Float_t*  curright;
+    Float_t*        in;
+    Float_t         sums [2];
     long            batchsamples;
     long            cursamples;
     long            cursamplepos;
-    int             i;
+    long            i;
 
     if ( num_samples == 0 )
         return GAIN_ANALYSIS_OK;
@@ -309,80 +547,21 @@ AnalyzeSamples (CTX, const Float_t* left_samples, const Float_t* right_samples,
     default: return GAIN_ANALYSIS_ERROR;
     }
 
-    if ( num_samples < MAX_ORDER ) {
-        memcpy ( linprebuf + MAX_ORDER, left_samples , num_samples * sizeof(Float_t) );
-        memcpy ( rinprebuf + MAX_ORDER, right_samples, num_samples * sizeof(Float_t) );
-    }
-    else {
-        memcpy ( linprebuf + MAX_ORDER, left_samples,  MAX_ORDER   * sizeof(Float_t) );
-        memcpy ( rinprebuf + MAX_ORDER, right_samples, MAX_ORDER   * sizeof(Float_t) );
-    }
-
     while ( batchsamples > 0 ) {
         cursamples = batchsamples > sampleWindow-totsamp  ?  sampleWindow - totsamp  :  batchsamples;
-        if ( cursamplepos < MAX_ORDER ) {
-            curleft  = linpre+cursamplepos;
-            curright = rinpre+cursamplepos;
-            if (cursamples > MAX_ORDER - cursamplepos )
-                cursamples = MAX_ORDER - cursamplepos;
-        }
-        else {
-            curleft  = left_samples  + cursamplepos;
-            curright = right_samples + cursamplepos;
-        }
-
-        YULE_FILTER ( curleft , lstep + totsamp, cursamples, ABYule[freqindex]);
-        YULE_FILTER ( curright, rstep + totsamp, cursamples, ABYule[freqindex]);
-
-        BUTTER_FILTER ( lstep + totsamp, lout + totsamp, cursamples, ABButter[freqindex]);
-        BUTTER_FILTER ( rstep + totsamp, rout + totsamp, cursamples, ABButter[freqindex]);
 
-        curleft = lout + totsamp;                   // Get the squared values
-        curright = rout + totsamp;
-
-        i = cursamples % 16;
-        while (i--)
-        {   lsum += fsqr(*curleft++);
-            rsum += fsqr(*curright++);
-        }
-        i = cursamples / 16;
-        while (i--)
-        {   lsum += fsqr(curleft[0])
-                  + fsqr(curleft[1])
-                  + fsqr(curleft[2])
-                  + fsqr(curleft[3])
-                  + fsqr(curleft[4])
-                  + fsqr(curleft[5])
-                  + fsqr(curleft[6])
-                  + fsqr(curleft[7])
-                  + fsqr(curleft[8])
-                  + fsqr(curleft[9])
-                  + fsqr(curleft[10])
-                  + fsqr(curleft[11])
-                  + fsqr(curleft[12])
-                  + fsqr(curleft[13])
-                  + fsqr(curleft[14])
-                  + fsqr(curleft[15]);
-            curleft += 16;
-            rsum += fsqr(curright[0])
-                  + fsqr(curright[1])
-                  + fsqr(curright[2])
-                  + fsqr(curright[3])
-                  + fsqr(curright[4])
-                  + fsqr(curright[5])
-                  + fsqr(curright[6])
-                  + fsqr(curright[7])
-                  + fsqr(curright[8])
-                  + fsqr(curright[9])
-                  + fsqr(curright[10])
-                  + fsqr(curright[11])
-                  + fsqr(curright[12])
-                  + fsqr(curright[13])
-                  + fsqr(curright[14])
-                  + fsqr(curright[15]);
-            curright += 16;
+        in = inbuf + (MAX_ORDER + totsamp) * 2;
+        for ( i = 0; i < cursamples; i++ ) {
+            in[2*i]     = left_samples [cursamplepos + i];
+            in[2*i + 1] = right_samples[cursamplepos + i];
         }
 
+        sums[0] = sums[1] = 0.;
+        ctx->filter ( in, stepbuf + (MAX_ORDER + totsamp) * 2, outbuf + (MAX_ORDER + totsamp) * 2,
+                      cursamples, yulekernel, butterkernel, sums );
+        lsum += sums[0];
+        rsum += sums[1];
+
         batchsamples -= cursamples;
         cursamplepos += cursamples;
         totsamp      += cursamples;
@@ -393,25 +572,14 @@ AnalyzeSamples (CTX, const Float_t* left_samples, const Float_t* right_samples,
             if ( ival >= (int)(sizeof(AA)/sizeof(*AA)) ) ival = sizeof(AA)/sizeof(*AA) - 1;
             AA [ival]++;
             lsum = rsum = 0.;
-            memmove ( loutbuf , loutbuf  + totsamp, MAX_ORDER * sizeof(Float_t) );
-            memmove ( routbuf , routbuf  + totsamp, MAX_ORDER * sizeof(Float_t) );
-            memmove ( lstepbuf, lstepbuf + totsamp, MAX_ORDER * sizeof(Float_t) );
-            memmove ( rstepbuf, rstepbuf + totsamp, MAX_ORDER * sizeof(Float_t) );
+            memmove ( inbuf  , inbuf   + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
+            memmove ( stepbuf, stepbuf + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
+            memmove ( outbuf , outbuf  + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
             totsamp = 0;
         }
         if ( totsamp > sampleWindow )   // somehow I really screwed up: Error in programming! Contact author about totsamp > sampleWindow
             return GAIN_ANALYSIS_ERROR;
     }
-    if ( num_samples < MAX_ORDER ) {
-        memmove ( linprebuf,                           linprebuf + num_samples, (MAX_ORDER-num_samples) * sizeof(Float_t) );
-        memmove ( rinprebuf,                           rinprebuf + num_samples, (MAX_ORDER-num_samples) * sizeof(Float_t) );
-        memcpy  ( linprebuf + MAX_ORDER - num_samples, left_samples,          num_samples             * sizeof(Float_t) );
-        memcpy  ( rinprebuf + MAX_ORDER - num_samples, right_samples,         num_samples             * sizeof(Float_t) );
-    }
-    else {
-        memcpy  ( linprebuf, left_samples  + num_samples - MAX_ORDER, MAX_ORDER * sizeof(Float_t) );
-        memcpy  ( rinprebuf, right_samples + num_samples - MAX_ORDER, MAX_ORDER * sizeof(Float_t) );
-    }
 
     return GAIN_ANALYSIS_OK;
 }
@@ -453,8 +621,8 @@ GetTitleGain (CTX)
         AA[i]  = 0;
     }
 
-    for ( i = 0; i < MAX_ORDER; i++ )
-        linprebuf[i] = lstepbuf[i] = loutbuf[i] = rinprebuf[i] = rstepbuf[i] = routbuf[i] = 0.f;
+    for ( i = 0; i < MAX_ORDER * 2; i++ )
+        inbuf[i] = stepbuf[i] = outbuf[i] = 0.f;
 
     totsamp = 0;
     lsum    = rsum = 0.;
@@ -468,4 +636,32 @@ GetAlbumGain (CTX)
     return analyzeResult (BB, sizeof(BB)/sizeof(*BB) );
 }
 
+
+// drops the title histogram and the current partial window, but keeps the filter state.
+// the next window starts with the next sample, so filters can be warmed up with audio
+// that preceeds the part to be analyzed
+
+void
+DiscardSamples (CTX)
+{
+    memmove ( inbuf  , inbuf   + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
+    memmove ( stepbuf, stepbuf + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
+    memmove ( outbuf , outbuf  + totsamp * 2, MAX_ORDER * 2 * sizeof(Float_t) );
+    totsamp = 0;
+    lsum    = rsum = 0.;
+    memset ( AA, 0, sizeof(AA) );
+}
+
+
+// adds the title histogram of other, both must use the same sample frequency
+
+void
+MergeGainAnalysis (CTX, const struct rg_state* other)
+{
+    size_t  i;
+
+    for ( i = 0; i < sizeof(AA)/sizeof(*AA); i++ )
+        AA[i] += other->A[i];
+}
+
 /* end of gain_analysis.c */
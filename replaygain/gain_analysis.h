@@ -49,7 +49,7 @@ typedef signed int      Int32_t;
 
 #define YULE_ORDER      10
 #define BUTTER_ORDER    2
-#define MAX_SAMP_FREQ   96000
+#define MAX_SAMP_FREQ   192000
 #define RMS_WINDOW      20             // maximum allowed sample frequency [Hz]
 #define STEPS_per_dB    100            // Table entries per dB
 #define MAX_dB          120            // Table entries for 0...MAX_dB (normal max. values are 70...80 dB)
@@ -57,24 +57,23 @@ typedef signed int      Int32_t;
 #define MAX_ORDER               (BUTTER_ORDER > YULE_ORDER ? BUTTER_ORDER : YULE_ORDER)
 #define MAX_SAMPLES_PER_WINDOW  (size_t) (MAX_SAMP_FREQ / RMS_WINDOW + 1)      // max. Samples per Time slice
 
+// filters <frames> interleaved stereo frames and adds the squared output to sums[0] and sums[1]
+typedef void (*rg_filter_t)(const Float_t* in, Float_t* step, Float_t* out, size_t frames,
+                            const Float_t* yule, const Float_t* butter, Float_t* sums);
+
+// the sample buffers hold interleaved stereo frames with MAX_ORDER frames of history in front
 struct rg_state {
-    Float_t     linprebuf [MAX_ORDER * 2];
-    Float_t*    linpre;                                          // left input samples, with pre-buffer
-    Float_t     lstepbuf  [MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-    Float_t*    lstep;                                           // left "first step" (i.e. post first filter) samples
-    Float_t     loutbuf   [MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-    Float_t*    lout;                                            // left "out" (i.e. post second filter) samples
-    Float_t     rinprebuf [MAX_ORDER * 2];
-    Float_t*    rinpre;                                          // right input samples ...
-    Float_t     rstepbuf  [MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-    Float_t*    rstep;
-    Float_t     routbuf   [MAX_SAMPLES_PER_WINDOW + MAX_ORDER];
-    Float_t*    rout;
+    Float_t     inbuf     [(MAX_SAMPLES_PER_WINDOW + MAX_ORDER) * 2];   // input samples
+    Float_t     stepbuf   [(MAX_SAMPLES_PER_WINDOW + MAX_ORDER) * 2];   // "first step" (i.e. post first filter) samples
+    Float_t     outbuf    [(MAX_SAMPLES_PER_WINDOW + MAX_ORDER) * 2];   // "out" (i.e. post second filter) samples
+    rg_filter_t filter;                                                 // scalar or SIMD version, selected at init
     long        sampleWindow;                                    // number of samples required to reach number of milliseconds required for RMS window
     long        totsamp;
     Float_t     lsum;
     Float_t     rsum;
-    int         freqindex;
+    int         freqindex;                                       // index into filter tables, 12 if derived
+    Float_t     yulekernel   [2 * YULE_ORDER + 1];
+    Float_t     butterkernel [2 * BUTTER_ORDER + 1];
     int         first;
     Uint32_t    A[(size_t)(STEPS_per_dB * MAX_dB)];
     Uint32_t    B[(size_t)(STEPS_per_dB * MAX_dB)];
@@ -85,6 +84,8 @@ int     AnalyzeSamples(struct rg_state* cxt, const Float_t* left_samples, const
 int     ResetSampleFrequency (struct rg_state* cxt, long samplefreq);
 Float_t GetTitleGain(struct rg_state* cxt);
 Float_t GetAlbumGain(struct rg_state* cxt);
+void    DiscardSamples(struct rg_state* cxt);
+void    MergeGainAnalysis(struct rg_state* cxt, const struct rg_state* other);
 
 #ifdef __cplusplus
 }
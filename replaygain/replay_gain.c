@@ -139,6 +139,17 @@ void rg_analyze(struct rg_context* ctx, void* data, int frames)
     AnalyzeSamples(&ctx->state, lbuf, rbuf, frames, ctx->channels);
 }
 
+void rg_discard(struct rg_context* ctx)
+{
+    DiscardSamples(&ctx->state);
+}
+
+void rg_merge(struct rg_context* ctx, struct rg_context* other)
+{
+    assert(ctx->samplerate == other->samplerate);
+    MergeGainAnalysis(&ctx->state, &other->state);
+}
+
 float rg_title_gain(struct rg_context* ctx)
 {
     float gain = GetTitleGain(&ctx->state);
@@ -17,7 +17,7 @@
 
 struct rg_context;
 
-/* samplerate   44100, 48000, etc...
+/* samplerate   1000 - 192000, rates without tabulated filters get derived ones
  * sampletype:  RG_SIGNED16, RG_SIGNED32, RG_FLOAT32
  * channels:    1, 2
  * interleaved: 0 (false), 1 (true)
@@ -33,6 +33,14 @@ void                rg_free(struct rg_context* ctx);
  */
 void                rg_analyze(struct rg_context* ctx, void* data, int frames);
 
+/* rg_discard forgets all analyzed data but keeps the filter state, use it
+ * after feeding some samples before the part you want analyzed to warm up
+ * the filters. rg_merge adds the title analysis of other to ctx, both must
+ * have the same samplerate.
+ */
+void                rg_discard(struct rg_context* ctx);
+void                rg_merge(struct rg_context* ctx, struct rg_context* other);
+
 float               rg_title_gain(struct rg_context* ctx);
 float               rg_album_gain(struct rg_context* ctx);
 
@@ -13,6 +13,7 @@
 #include <math.h>
 #include <strings.h>
 #include <limits.h>
+#include <pthread.h>
 #include <id3tag.h>
 #include <bass.h>
 #include "log.h"
@@ -22,16 +23,107 @@
 
 #define IS_MOD(dec)         (bool)((dec)->channel_info.ctype & BASS_CTYPE_MUSIC_MOD)
 #define IS_AMIGAMOD(dec)    (bool)((dec)->channel_info.ctype == BASS_CTYPE_MUSIC_MOD)
+#define SKIP_FRAMES         4096    // chunk size when decoding up to a seek target
+#define RENDER_FRAMES       4096    // chunk size of the render thread
+
+// music rendered ahead of the playhead by a background thread. the ring buffer holds
+// interleaved frames. lock protects the ring, channel_lock is held while the thread
+// renders and while seeking, always taken before lock.
+struct prerender {
+    pthread_t           thread;
+    pthread_mutex_t     lock;
+    pthread_mutex_t     channel_lock;
+    pthread_cond_t      cond;
+    float*              ring;
+    long                size;           // frames
+    long                read_pos;
+    long                fill;
+    long                render_frame;
+    bool                done;
+    bool                quit;
+    long                rendered;       // for the real time factor
+    double              render_time;    // seconds
+};
 
 struct bassdecoder {
     struct buffer       read_buffer;
+    struct mapping      map;        // streams read from it until they are freed
+    struct prerender*   render;     // NULL unless bass_prerender was called
     DWORD               channel;
     BASS_CHANNELINFO    channel_info;
     int                 samplerate;
     long                current_frame;
     long                last_frame;
+    bool                byte_seek;  // false for music that wasn't prescanned
 };
 
+static void* render_thread(void* data)
+{
+    struct bassdecoder* d = data;
+    struct prerender*   r = d->render;
+    int                 ch = d->channel_info.chans;
+    float*              chunk = util_malloc(RENDER_FRAMES * ch * sizeof (float));
+
+    while (true) {
+        pthread_mutex_lock(&r->lock);
+        while (!r->quit && (r->done || r->size - r->fill < RENDER_FRAMES))
+            pthread_cond_wait(&r->cond, &r->lock);
+        bool quit = r->quit;
+        pthread_mutex_unlock(&r->lock);
+        if (quit)
+            break;
+
+        pthread_mutex_lock(&r->channel_lock);
+        long frames = CLAMP(0, d->last_frame - r->render_frame, RENDER_FRAMES);
+        double start = util_time();
+        DWORD bytes = frames ? BASS_ChannelGetData(d->channel, chunk, frames * ch * sizeof (float)) : 0;
+        double elapsed = util_time() - start;
+        long got = (bytes == (DWORD)-1) ? 0 : bytes / (ch * sizeof (float));
+
+        pthread_mutex_lock(&r->lock);
+        long pos = (r->read_pos + r->fill) % r->size;
+        long first = MIN(got, r->size - pos);
+        memcpy(r->ring + pos * ch, chunk, first * ch * sizeof (float));
+        memcpy(r->ring, chunk + first * ch, (got - first) * ch * sizeof (float));
+        r->fill += got;
+        r->render_frame += got;
+        r->rendered += got;
+        r->render_time += elapsed;
+        r->done = got < frames || r->render_frame >= d->last_frame;
+        pthread_cond_broadcast(&r->cond);
+        pthread_mutex_unlock(&r->lock);
+        pthread_mutex_unlock(&r->channel_lock);
+    }
+
+    free(chunk);
+    return NULL;
+}
+
+// waits until the render thread has enough frames, or can't render more because the ring
+// is full
+static void render_decode(struct bassdecoder* d, struct stream* s, int frames)
+{
+    struct prerender*   r = d->render;
+    int                 ch = d->channel_info.chans;
+
+    pthread_mutex_lock(&r->lock);
+    while (!r->done && r->fill < frames && r->size - r->fill >= RENDER_FRAMES)
+        pthread_cond_wait(&r->cond, &r->lock);
+    frames = MIN(frames, r->fill);
+    long first = MIN(frames, r->size - r->read_pos);
+    void* src = r->ring + r->read_pos * ch;
+    s->frames = 0;
+    stream_append_convert(s, &src, SF_FLOAT32I, first, ch);
+    src = r->ring;
+    stream_append_convert(s, &src, SF_FLOAT32I, frames - first, ch);
+    r->read_pos = (r->read_pos + frames) % r->size;
+    r->fill -= frames;
+    d->current_frame += frames;
+    s->end_of_stream = r->done && !r->fill;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+}
+
 static void bass_decode(struct decoder* dec, struct stream* s, int frames)
 {
     struct bassdecoder* d = dec->handle;
@@ -42,6 +134,10 @@ static void bass_decode(struct decoder* dec, struct stream* s, int frames)
         s->frames = 0;
         return;
     }
+    if (d->render) {
+        render_decode(d, s, frames);
+        return;
+    }
 
     frames = CLAMP(0, d->last_frame - d->current_frame, frames);
     DWORD bytes_to_read = frames * ch * sizeof (float);
@@ -60,9 +156,61 @@ static void bass_decode(struct decoder* dec, struct stream* s, int frames)
         LOG_DEBUG("[bassdecoder] eos %d frames left", s->frames);
 }
 
+// byte positions work for streams and prescanned music. bass may land a bit before the
+// requested position, for music it goes back to the start of the row. the rest is decoded
+// and dropped, so current_frame ends up on the target. music that wasn't prescanned can only
+// skip forward by decoding.
+static void seek_channel(struct bassdecoder* d, long position)
+{
+    int ch = d->channel_info.chans;
+    if (ch != 2 && ch != 1)
+        return;
+
+    long frame_size = sizeof (float) * ch;
+    position = CLAMP(0, position, d->last_frame);
+    if (d->byte_seek) {
+        if (!BASS_ChannelSetPosition(d->channel, (QWORD)position * frame_size, BASS_POS_BYTE)) {
+            LOG_WARN("[bassdecoder] seek failed (%d)", BASS_ErrorGetCode());
+            return;
+        }
+        QWORD landed = BASS_ChannelGetPosition(d->channel, BASS_POS_BYTE);
+        d->current_frame = (landed == (QWORD)-1) ? position : (long)(landed / frame_size);
+    } else if (position < d->current_frame) {
+        LOG_WARN("[bassdecoder] can't seek backwards in music without prescan");
+        return;
+    }
+    while (d->current_frame < position) {
+        DWORD bytes_to_read = MIN(position - d->current_frame, SKIP_FRAMES) * frame_size;
+        buffer_resize(&d->read_buffer, bytes_to_read);
+        DWORD bytes_read = BASS_ChannelGetData(d->channel, d->read_buffer.data, bytes_to_read);
+        if (bytes_read == -1 || bytes_read == 0)
+            break;
+        d->current_frame += bytes_read / frame_size;
+    }
+    if (d->current_frame != position)
+        LOG_DEBUG("[bassdecoder] seek landed %ld frames off", d->current_frame - position);
+}
+
+// with a render thread everything rendered ahead is thrown away, it starts again after
+// the seek
 static void bass_seek(struct decoder* dec, long position)
 {
-    // TODO implement me!
+    struct bassdecoder* d = dec->handle;
+    struct prerender*   r = d->render;
+    if (!r) {
+        seek_channel(d, position);
+        return;
+    }
+    pthread_mutex_lock(&r->channel_lock);
+    pthread_mutex_lock(&r->lock);
+    seek_channel(d, position);
+    r->read_pos = 0;
+    r->fill = 0;
+    r->render_frame = d->current_frame;
+    r->done = false;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_mutex_unlock(&r->channel_lock);
 }
 
 static const char* codec_type(struct bassdecoder* d)
@@ -96,6 +244,12 @@ static void bass_info(struct decoder* dec, struct info* info)
     info->frames        = d->last_frame;
     info->flags         = INFO_BASS;
     info->codec         = codec_type(d);
+    // without a known length bass can't map positions to bytes. music that wasn't
+    // prescanned only skips forward by decoding.
+    if (!d->byte_seek)
+        info->flags |= INFO_FORWARD;
+    else if (d->last_frame != LONG_MAX)
+        info->flags |= INFO_SEEKABLE;
     if (IS_MOD(d))
         info->flags |= INFO_MOD;
     if (IS_AMIGAMOD(d))
@@ -194,9 +348,31 @@ static char* bass_metadata(struct decoder* dec, const char* key)
     return util_trim(get_tag(d->channel, key));
 }
 
+static void render_free(struct bassdecoder* d)
+{
+    struct prerender* r = d->render;
+    pthread_mutex_lock(&r->lock);
+    r->quit = true;
+    pthread_cond_broadcast(&r->cond);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+
+    if (r->render_time > 0)
+        LOG_INFO("[bassdecoder] rendered %.1f seconds at %.1fx real time", (double)r->rendered / d->channel_info.freq,
+            r->rendered / (r->render_time * d->channel_info.freq));
+    pthread_mutex_destroy(&r->lock);
+    pthread_mutex_destroy(&r->channel_lock);
+    pthread_cond_destroy(&r->cond);
+    free(r->ring);
+    free(r);
+    d->render = NULL;
+}
+
 static void bass_free(struct decoder* dec)
 {
     struct bassdecoder* d = dec->handle;
+    if (d->render)
+        render_free(d);
     buffer_free(&d->read_buffer);
     if (d->channel) {
         if (IS_MOD(d))
@@ -206,6 +382,7 @@ static void bass_free(struct decoder* dec)
         if (BASS_ErrorGetCode() != BASS_OK)
              LOG_WARN("[bassdecoder] failed to free channel (%d)", BASS_ErrorGetCode());
     }
+    util_unmap_file(&d->map);
     free(d);
     memset(dec, 0, sizeof *dec);
 }
@@ -217,6 +394,35 @@ void bass_set_loop_duration(struct decoder* dec, double duration)
     BASS_ChannelFlags(d->channel, BASS_SAMPLE_LOOP, BASS_SAMPLE_LOOP);
 }
 
+bool bass_prerender(struct decoder* dec, long max_bytes)
+{
+    struct bassdecoder* d = dec->handle;
+    int ch = d->channel_info.chans;
+    if (d->render || !IS_MOD(d) || (ch != 2 && ch != 1))
+        return false;
+
+    struct prerender* r = calloc(1, sizeof *r);
+    r->size = MAX(4 * RENDER_FRAMES, max_bytes / (long)(ch * sizeof (float)));
+    r->ring = util_malloc(r->size * ch * sizeof (float));
+    r->render_frame = d->current_frame;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_mutex_init(&r->channel_lock, NULL);
+    pthread_cond_init(&r->cond, NULL);
+    d->render = r;
+    if (pthread_create(&r->thread, NULL, render_thread, d)) {
+        LOG_ERROR("[bassdecoder] can't start render thread");
+        pthread_mutex_destroy(&r->lock);
+        pthread_mutex_destroy(&r->channel_lock);
+        pthread_cond_destroy(&r->cond);
+        free(r->ring);
+        free(r);
+        d->render = NULL;
+        return false;
+    }
+    LOG_DEBUG("[bassdecoder] rendering ahead up to %ld frames", r->size);
+    return true;
+}
+
 bool bass_load(struct decoder* dec, const char* path, const char* options, int samplerate)
 {
     static bool initialized = false;
@@ -231,16 +437,34 @@ bool bass_load(struct decoder* dec, const char* path, const char* options, int s
 
     LOG_DEBUG("[bassdecoder] loading %s", path);
 
-    // always prescan music or it may loop forever, BASS_MUSIC_STOPBACK would fix that
-    // but might also break some mods from playing correctly
+    // music is prescanned or it may loop forever. the prescan renders the whole module, for
+    // long ones that takes seconds. with bass_no_prescan a known length ends the music
+    // instead, without length BASS_MUSIC_STOPBACK does, but that may break some mods.
     bool prescan = keyval_bool(options, "bass_prescan", false);
+    bool no_prescan = keyval_bool(options, "bass_no_prescan", false);
+    double length = keyval_real(options, "length", 0);
     DWORD stream_flags = BASS_STREAM_DECODE | (prescan ? BASS_STREAM_PRESCAN : 0) | BASS_SAMPLE_FLOAT;
-    DWORD music_flags = BASS_MUSIC_DECODE | BASS_MUSIC_PRESCAN | BASS_MUSIC_FLOAT;
-
-    DWORD channel = BASS_StreamCreateFile(FALSE, path, 0, 0, stream_flags);
-    if (!channel)
-        channel = BASS_MusicLoad(FALSE, path, 0, 0 , music_flags, samplerate);
+    DWORD music_flags = BASS_MUSIC_DECODE | BASS_MUSIC_FLOAT;
+    if (!no_prescan)
+        music_flags |= BASS_MUSIC_PRESCAN;
+    else if (length <= 0)
+        music_flags |= BASS_MUSIC_STOPBACK;
+
+    // local files are loaded from memory, music is copied by bass so the mapping is only
+    // kept for streams. zipped and gzipped files are unpacked.
+    struct mapping map = {0};
+    DWORD channel = 0;
+    if (util_load_file(&map, path, UNPACK_LIMIT)) {
+        channel = BASS_StreamCreateFile(TRUE, map.data, 0, map.size, stream_flags);
+        if (!channel)
+            channel = BASS_MusicLoad(TRUE, map.data, 0, map.size, music_flags, samplerate);
+    } else {
+        channel = BASS_StreamCreateFile(FALSE, path, 0, 0, stream_flags);
+        if (!channel)
+            channel = BASS_MusicLoad(FALSE, path, 0, 0 , music_flags, samplerate);
+    }
     if (!channel) {
+        util_unmap_file(&map);
         LOG_DEBUG("[bassdecoder] failed to load %s", path);
         return false;
     }
@@ -249,8 +473,14 @@ bool bass_load(struct decoder* dec, const char* path, const char* options, int s
     d->channel = channel;
 
     BASS_ChannelGetInfo(channel, &d->channel_info);
+    if (IS_MOD(d))
+        util_unmap_file(&map);
+    d->map = map;
     long len_bytes = (long)BASS_ChannelGetLength(channel, BASS_POS_BYTE);
     d->last_frame = (len_bytes < 0) ? LONG_MAX : len_bytes / (sizeof (float) * d->channel_info.chans);
+    d->byte_seek = !IS_MOD(d) || !no_prescan;
+    if (!d->byte_seek)
+        d->last_frame = (length > 0) ? length * d->channel_info.freq : LONG_MAX;
 
     if (IS_MOD(d)) {
         // interpolation, values: auto, auto, off, linear, sinc (bass uses linear as default)
@@ -289,50 +519,10 @@ bool bass_load(struct decoder* dec, const char* path, const char* options, int s
     return true;
 }
 
-float bass_loopiness(const char* path)
-{
-    // what I'm doing here is find the last 50 ms of a track and return the average positive value
-    // i got a bit lazy here, but this part isn't so crucial anyways
-    // flags to make decoding as fast as possible. still use 44100 hz, because lower setting might
-    // remove upper frequencies that could indicate a loop
-    float loopiness     = 0;
-    int flags           = BASS_MUSIC_DECODE | BASS_SAMPLE_MONO | BASS_MUSIC_NONINTER | BASS_MUSIC_PRESCAN;
-    int samplerate      = 44100;
-    int check_frames    = samplerate / 20;
-    int check_bytes     = check_frames * sizeof (int16_t);
-    int16_t* buf        = NULL;
-
-    HMUSIC channel = BASS_MusicLoad(FALSE, path, 0, 0 , flags, samplerate);
-
-    BASS_CHANNELINFO channel_info = {0};
-    BASS_ChannelGetInfo(channel, &channel_info);
-    if (!(channel_info.ctype & BASS_CTYPE_MUSIC_MOD))
-        goto error;
-
-    QWORD length = BASS_ChannelGetLength(channel, BASS_POS_BYTE);
-    if (!BASS_ChannelSetPosition(channel, length - check_bytes, BASS_POS_BYTE))
-        goto error;
-
-    buf = calloc(check_bytes, 1);
-    for (int i = 0; i < check_bytes && BASS_ErrorGetCode() == BASS_OK;) {
-        DWORD r = BASS_ChannelGetData(channel, (char*)buf + i, check_bytes - i);
-        i += r;
-    }
-
-    long accu = 0;
-    for (int i = 0; i < check_frames; i++)
-        accu += fabs(buf[i]);
-    loopiness = (float)accu / check_frames / -INT16_MIN;
-
-error:
-    BASS_MusicFree(channel);
-    free(buf);
-    return loopiness;
-}
-
 bool bass_probe(const char* path)
 {
-    const char* ext[] = {".mp3", ".mp2", ".wav", ".aiff", ".xm", ".mod", ".s3m", ".it", ".mtm", ".umx", ".mo3", ".fst"};
+    const char* ext[] = {".mp3", ".mp2", ".wav", ".aiff", ".xm", ".mod", ".s3m", ".it", ".mtm", ".umx", ".mo3", ".fst",
+                         ".mdz", ".s3z", ".xmz", ".itz", ".zip", ".gz"};
     for (int i = 0; i < COUNT(ext); i++) {
         const char* tmp = strrchr(path, '.');
         if (tmp && !strcasecmp(tmp, ext[i]))
@@ -17,7 +17,13 @@ bool    bass_loadso(void);
 bool    bass_probe(const char* path);
 bool    bass_load(struct decoder* dec, const char* path, const char* options, int samplerate);
 void    bass_set_loop_duration(struct decoder* dec, double duration);
-float   bass_loopiness(const char* path);
+
+/*  bass_prerender
+ *      renders music on a background thread into a buffer of up to <max_bytes>, ahead of
+ *      what is decoded. call it after bass_set_loop_duration. returns false for streams,
+ *      they are decoded as before.
+ */
+bool    bass_prerender(struct decoder* dec, long max_bytes);
 
 #endif
 
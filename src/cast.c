@@ -18,7 +18,9 @@
 #include <shout/shout.h>
 #include "settings.h"
 #include "effects.h"
-#include "ffdecoder.h"
+#include "decoder.h"
+#include "prefetch.h"
+#include "pcmcache.h"
 #ifdef ENABLE_BASS
     #include "bassdecoder.h"
 #endif
@@ -47,6 +49,7 @@ static struct stream    stream0;
 static struct stream    stream1;
 static struct buffer    remote_buf;
 static struct buffer    config_buf;
+static struct buffer    next_buf;
 static struct buffer    lame_buf;
 static struct info      info;
 static struct decoder   decoder;
@@ -55,32 +58,73 @@ static struct fx_mix    mixer;
 static void*            resampler;
 static float            gain;
 static long             remaining_frames;
+static long             prefetch_frames;    // frames until the next song is requested
 static bool             mixer_enabled;
 static bool             fader_enabled;
 static bool             have_remote;
+static bool             have_next;
+static bool             next_requested;
+static bool             first_block;        // log time to first sample
+static double           load_start;
+static pthread_mutex_t  next_lock = PTHREAD_MUTEX_INITIALIZER;
 static sig_atomic_t     decoder_ready;
 static sig_atomic_t     remote_command;
 
-static void get_next_song(void)
+static void request_song(struct buffer* buf)
 {
-    if (have_remote) {
-        have_remote = false; // config_buf already contains info
-    } else if (settings_debug_song) {
-        buffer_resize(&config_buf, strlen(settings_debug_song) + 1);
-        strcpy(config_buf.data, settings_debug_song);
+    if (settings_debug_song) {
+        buffer_resize(buf, strlen(settings_debug_song) + 1);
+        strcpy(buf->data, settings_debug_song);
     } else {
-        buffer_zero(&config_buf);
+        buffer_zero(buf);
         int socket = socket_connect(settings_demovibes_host, settings_demovibes_port);
         if (socket < 0) {
             LOG_ERROR("[cast] can't connect to demosauce");
             return;
         }
         socket_write(socket, "NEXTSONG", 8);
-        socket_read(socket, &config_buf);
+        socket_read(socket, buf);
         socket_close(socket);
     }
 }
 
+static void get_next_song(void)
+{
+    pthread_mutex_lock(&next_lock);
+    if (have_remote) {
+        have_remote = false; // config_buf already contains info
+    } else if (have_next) {
+        struct buffer tmp = config_buf;
+        config_buf = next_buf;
+        next_buf = tmp;
+        have_next = false;
+    } else {
+        request_song(&config_buf);
+    }
+    pthread_mutex_unlock(&next_lock);
+}
+
+// requests the next song before the current one ends and reads its file into the page cache
+static void* fetch_next(void* data)
+{
+    char path[4096] = {0};
+
+    pthread_mutex_lock(&next_lock);
+    if (!have_next) {
+        request_song(&next_buf);
+        if (next_buf.data)
+            keyval_str(path, sizeof(path), next_buf.data, "path", "");
+        have_next = *path;
+    }
+    pthread_mutex_unlock(&next_lock);
+
+    if (*path) {
+        LOG_DEBUG("[cast] prefetching '%s'", path);
+        prefetch_start(path, settings_prefetch_size * 1024L * 1024L);
+    }
+    return NULL;
+}
+
 static void zero_generator(struct decoder* dec, struct stream* s, int frames)
 {
     s->frames = frames;
@@ -89,15 +133,27 @@ static void zero_generator(struct decoder* dec, struct stream* s, int frames)
     stream_zero(s, 0, frames);
 }
 
-static void configure_effects(const char* config, float forced_length)
+static void configure_effects(const char* config, float forced_length, float cue_in)
 {
-    // play length
+    // play length, playback starts at cue_in and cue_out may cut off the end
+    float end_time = forced_length;
+    float cue_out = keyval_real(config, "cue_out", 0);
+    if (cue_out > cue_in && (end_time <= 0 || cue_out < end_time)) {
+        end_time = cue_out;
+        LOG_DEBUG("[cast] cue out at %f seconds", cue_out);
+    }
     remaining_frames = LONG_MAX;
-    if (forced_length > 0) {
-        remaining_frames = settings_encoder_samplerate * forced_length;
-        LOG_DEBUG("[cast] song length forced to %f seconds", forced_length);
+    if (end_time > 0) {
+        remaining_frames = settings_encoder_samplerate * (end_time - cue_in);
+        LOG_DEBUG("[cast] song length forced to %f seconds", end_time - cue_in);
     }
 
+    // the decoder's length may be off, it's good enough to know when to prefetch but the
+    // song still plays until the end of stream
+    prefetch_frames = remaining_frames;
+    if (end_time <= 0 && info.frames > 0)
+        prefetch_frames = settings_encoder_samplerate * ((double)info.frames / info.samplerate - cue_in);
+
     // resampler
     fx_resample_free(resampler);
     resampler = NULL;
@@ -125,7 +181,7 @@ static void configure_effects(const char* config, float forced_length)
     // fade out
     fader_enabled = keyval_bool(config, "fade_out", false);
     if (fader_enabled) {
-        float length = forced_length > 0 ? forced_length : (info.frames / info.samplerate);
+        float length = (end_time > 0 ? end_time : (info.frames / info.samplerate)) - cue_in;
         long start = MAX(0, (length - FADE_TIME)) * settings_encoder_samplerate;
         long end = length * settings_encoder_samplerate;
         fx_fade_init(&fader, start, end, 1, 0);
@@ -171,6 +227,7 @@ static void remote_handler(void)
         break;
     case COMMAND_SKIP:
         remaining_frames = FADE_TIME * settings_encoder_samplerate;
+        prefetch_frames = remaining_frames;
         fader_enabled = true;
         fx_fade_init(&fader, 0, remaining_frames, 1, 0);
         break;
@@ -225,9 +282,12 @@ static void* load_next(void* data)
 {
     char    path[4096]      = {0};
     float   forced_length   = 0;
+    float   cue_in          = 0;
     int     tries           = 0;
     bool    loaded          = false;
+    bool    cached          = false;
 
+    load_start = util_time();
     if (decoder.free)
         decoder.free(&decoder);
     memset(&decoder, 0, sizeof(struct decoder));
@@ -236,11 +296,12 @@ static void* load_next(void* data)
     while (tries++ < LOAD_TRIES && !loaded) {
         get_next_song();
         keyval_str(path, sizeof(path), config_buf.data, "path", "");
-#ifdef ENABLE_BASS
-        loaded = bass_load(&decoder, path, config_buf.data, settings_encoder_samplerate);
-#endif
+        if (settings_prefetch_time > 0)
+            prefetch_check(path);
+        if (settings_cache_dir)
+            loaded = cached = pcmcache_load(&decoder, path, config_buf.data, settings_encoder_samplerate);
         if (!loaded)
-            loaded = ff_load(&decoder, path);
+            loaded = decoder_load(&decoder, path, config_buf.data, settings_encoder_samplerate);
         if (!loaded) {
             LOG_ERROR("[cast] failed to load '%s'", path);
             sleep(3);
@@ -256,6 +317,29 @@ static void* load_next(void* data)
         if ((info.flags & INFO_BASS) && forced_length > info.frames / info.samplerate)
             bass_set_loop_duration(&decoder, forced_length);
 #endif
+        // skip leading silence, only if the decoder can seek. it's at the start, so
+        // forward is enough
+        cue_in = keyval_real(config_buf.data, "cue_in", 0);
+        if (cue_in > 0 && (info.flags & (INFO_SEEKABLE | INFO_FORWARD))) {
+            // the cached version starts at cue_in, the effects expect the original length
+            if (cached)
+                info.frames += cue_in * info.samplerate;
+            else
+                decoder.seek(&decoder, cue_in * info.samplerate);
+            LOG_DEBUG("[cast] cue in at %f seconds", cue_in);
+        } else {
+            cue_in = 0;
+        }
+#ifdef ENABLE_BASS
+        if (settings_bass_prerender > 0 && (info.flags & INFO_BASS) && (info.flags & INFO_MOD))
+            bass_prerender(&decoder, settings_bass_prerender * 1024L * 1024L);
+#endif
+        // the cached version starts at cue_in and is resampled, it can't be recorded if
+        // the decoder couldn't seek to cue_in
+        if (settings_cache_dir && !cached && cue_in == keyval_real(config_buf.data, "cue_in", 0)) {
+            pcmcache_record(&decoder, path, config_buf.data, settings_encoder_samplerate);
+            decoder.info(&decoder, &info);
+        }
     } else {
         LOG_WARN("[cast] load failed three times, sending one minute sound of silence");
         decoder.decode  = zero_generator;
@@ -265,8 +349,9 @@ static void* load_next(void* data)
         buffer_zero(&config_buf);
     }
 
-    configure_effects(config_buf.data, forced_length);
+    configure_effects(config_buf.data, forced_length, cue_in);
     update_metadata(config_buf.data);
+    first_block = true;
     decoder_ready = true;
     return NULL;
 }
@@ -283,6 +368,7 @@ static void cast_free(void)
     stream_free(&stream1);
     buffer_free(&remote_buf);
     buffer_free(&config_buf);
+    buffer_free(&next_buf);
     buffer_free(&lame_buf);
     fx_resample_free(resampler);
     resampler = NULL;
@@ -365,10 +451,23 @@ static void main_loop(void)
             stream_zero(s, 0, decode_frames);
         } else {
             s = process(decode_frames);
+            if (first_block) {
+                first_block = false;
+                LOG_INFO("[cast] first sample after %.0f ms", (util_time() - load_start) * 1000);
+            }
             remaining_frames -= s->frames;
+            prefetch_frames -= s->frames;
+            if (settings_prefetch_time > 0 && !next_requested
+                && prefetch_frames < (long)settings_prefetch_time * settings_encoder_samplerate) {
+                next_requested = true;
+                pthread_t thread = {0};
+                pthread_create(&thread, NULL, fetch_next, NULL);
+                pthread_detach(thread);
+            }
             if (s->end_of_stream || remaining_frames < 0) {
                 LOG_DEBUG("[cast] end of stream");
                 decoder_ready = false;
+                next_requested = false;
                 pthread_t thread = {0};
                 pthread_create(&thread, NULL, load_next, NULL);
                 pthread_detach(thread);
@@ -0,0 +1,378 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include "log.h"
+#include "ffdecoder.h"
+#ifdef ENABLE_BASS
+    #include "bassdecoder.h"
+#endif
+#include "decoder.h"
+
+#define HEAD_SIZE       1084    // mod signature is at 1080
+#define MAX_BACKENDS    8
+#define MAX_STATS       64
+#define MIN_TRIES       8       // a few broken files shouldn't change the order
+#define MIN_MARGIN      .25f
+#define MAGIC(m)        m, sizeof m - 1
+
+struct format {
+    const char* name;
+    int         offset;
+    const char* magic;
+    int         size;
+};
+
+// how often each backend managed to load a format, to find out when the preferred one
+// doesn't work for what's in the archive
+struct stats {
+    const char* format;
+    int         tries[MAX_BACKENDS];
+    int         loads[MAX_BACKENDS];
+};
+
+#ifdef ENABLE_BASS
+static bool load_bass(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    return bass_loadso() && bass_load(dec, path, options, samplerate);
+}
+
+// bass plays everything it can, that's how it has always been
+static const char* bass_formats[] = {"xm", "it", "s3m", "mtm", "mo3", "umx", "mod", "gzip",
+    "zip", "wav", "aiff", "vorbis", "mp3", "mpeg", NULL};
+#endif
+
+static bool load_ffmpeg(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    return ff_load(dec, path, options);
+}
+
+static const char* ffmpeg_formats[] = {"opus", "ogg", "flac", "mp4", "wma", "ape", "wavpack",
+    "mpc", "ra", "ac3", "aac", NULL};
+
+// bass has global state and some avcodec versions have no thread safe open
+static struct decoder_backend backends[MAX_BACKENDS] = {
+#ifdef ENABLE_BASS
+    {"bass",    10, false,  bass_probe,     load_bass,      bass_formats},
+#endif
+    {"ffmpeg",  0,  false,  ff_probe_name,  load_ffmpeg,    ffmpeg_formats}
+};
+
+#ifdef ENABLE_BASS
+static int backend_count = 2;
+#else
+static int backend_count = 1;
+#endif
+
+static const struct format formats[] = {
+    {"xm",      0,  MAGIC("Extended Module: ")},
+    {"it",      0,  MAGIC("IMPM")},
+    {"s3m",     44, MAGIC("SCRM")},
+    {"mtm",     0,  MAGIC("MTM")},
+    {"mo3",     0,  MAGIC("MO3")},
+    {"umx",     0,  MAGIC("\xc1\x83\x2a\x9e")},
+    {"gzip",    0,  MAGIC("\x1f\x8b")},     // most likely a packed module
+    {"zip",     0,  MAGIC("PK\x03\x04")},
+    {"wav",     8,  MAGIC("WAVE")},
+    {"aiff",    8,  MAGIC("AIFF")},
+    {"aiff",    8,  MAGIC("AIFC")},
+    {"vorbis",  28, MAGIC("\x01vorbis")},
+    {"opus",    28, MAGIC("OpusHead")},
+    {"ogg",     0,  MAGIC("OggS")},
+    {"flac",    0,  MAGIC("fLaC")},
+    {"mp4",     4,  MAGIC("ftyp")},
+    {"wma",     0,  MAGIC("\x30\x26\xb2\x75\x8e\x66\xcf\x11")},
+    {"ape",     0,  MAGIC("MAC ")},
+    {"wavpack", 0,  MAGIC("wvpk")},
+    {"mpc",     0,  MAGIC("MPCK")},
+    {"mpc",     0,  MAGIC("MP+")},
+    {"ra",      0,  MAGIC(".ra\xfd")},
+    {"ac3",     0,  MAGIC("\x0b\x77")},
+    {"mp3",     0,  MAGIC("ID3")}
+};
+
+static const struct format mod_format       = {"mod"};
+static const struct format mpeg_format      = {"mpeg"};
+static const struct format aac_format       = {"aac"};
+static const struct format unknown_format   = {"unknown"};
+
+static struct stats     stats[MAX_STATS];
+static int              stats_count;
+static pthread_mutex_t  stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t  load_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static bool is_mod(const unsigned char* sig)
+{
+    const char* sigs[] = {"M.K.", "M!K!", "M&K!", "FLT4", "FLT8", "CD81", "OKTA", "OCTA"};
+    for (int i = 0; i < COUNT(sigs); i++)
+        if (!memcmp(sig, sigs[i], 4))
+            return true;
+    // xCHN, xxCH and xxCN
+    if (isdigit(sig[0]) && !memcmp(sig + 1, "CHN", 3))
+        return true;
+    return isdigit(sig[0]) && isdigit(sig[1]) && (!memcmp(sig + 2, "CH", 2) || !memcmp(sig + 2, "CN", 2));
+}
+
+static const struct format* sniff(const char* path)
+{
+    unsigned char   head[HEAD_SIZE] = {0};
+    FILE*           f               = fopen(path, "rb");
+    if (!f)
+        return &unknown_format;
+    int size = fread(head, 1, sizeof head, f);
+    fclose(f);
+
+    for (int i = 0; i < COUNT(formats); i++) {
+        const struct format* fmt = &formats[i];
+        if (fmt->offset + fmt->size <= size && !memcmp(head + fmt->offset, fmt->magic, fmt->size))
+            return fmt;
+    }
+    if (size >= HEAD_SIZE && is_mod(head + 1080))
+        return &mod_format;
+    // mpeg audio frame sync, layer 0 is aac in an adts stream
+    if (size >= 2 && head[0] == 0xff && (head[1] & 0xe0) == 0xe0)
+        return (head[1] & 0x06) ? &mpeg_format : &aac_format;
+    return &unknown_format;
+}
+
+static int find_backend(const char* name)
+{
+    for (int i = 0; i < backend_count; i++)
+        if (!strcmp(backends[i].name, name))
+            return i;
+    return -1;
+}
+
+static bool claims(const struct decoder_backend* backend, const struct format* fmt, const char* path)
+{
+    if (fmt == &unknown_format)
+        return backend->probe && backend->probe(path);
+    for (const char** f = backend->formats; f && *f; f++)
+        if (!strcmp(*f, fmt->name))
+            return true;
+    return false;
+}
+
+// stats_lock must be held
+static struct stats* find_stats(const char* format)
+{
+    for (int i = 0; i < stats_count; i++)
+        if (!strcmp(stats[i].format, format))
+            return &stats[i];
+    if (stats_count == MAX_STATS)
+        return NULL;
+    memset(&stats[stats_count], 0, sizeof stats[0]);
+    stats[stats_count].format = format;
+    return &stats[stats_count++];
+}
+
+// stats_lock must be held. the rate is smoothed, a backend with few tries is close to .5
+static float success_rate(const struct stats* st, int backend)
+{
+    return (st->loads[backend] + 1.f) / (st->tries[backend] + 2.f);
+}
+
+// stats_lock must be held. fallbacks only try files the backend before them failed on, so
+// both need enough tries and a clearly better rate to swap places.
+static bool works_better(const struct stats* st, int backend, int other)
+{
+    if (!st || st->tries[backend] < MIN_TRIES || st->tries[other] < MIN_TRIES)
+        return false;
+    return success_rate(st, backend) > success_rate(st, other) + MIN_MARGIN;
+}
+
+// backends that claim the format go first, the others follow, both by priority. a backend
+// that keeps failing on a format is moved behind one that loads it.
+static int backend_order(const struct format* fmt, const char* path, int* order)
+{
+    int count = 0;
+
+    for (int pass = 0; pass < 2; pass++) {
+        bool    claimed = pass == 0;
+        int     group   = count;
+        for (int i = 0; i < backend_count; i++) {
+            if (claims(&backends[i], fmt, path) != claimed)
+                continue;
+            int j = count++;
+            for (; j > group && backends[order[j - 1]].priority < backends[i].priority; j--)
+                order[j] = order[j - 1];
+            order[j] = i;
+        }
+    }
+
+    // insertion sort, the order only changes when the stats are clear
+    pthread_mutex_lock(&stats_lock);
+    struct stats* st = find_stats(fmt->name);
+    for (int i = 1; i < count; i++) {
+        for (int j = i; j > 0 && works_better(st, order[j], order[j - 1]); j--) {
+            int o = order[j];
+            order[j] = order[j - 1];
+            order[j - 1] = o;
+        }
+    }
+    pthread_mutex_unlock(&stats_lock);
+    return count;
+}
+
+static void update_stats(const char* format, int backend, bool loaded)
+{
+    pthread_mutex_lock(&stats_lock);
+    struct stats* st = find_stats(format);
+    if (st) {
+        st->tries[backend]++;
+        st->loads[backend] += loaded;
+        LOG_DEBUG("[decoder] %s loaded %d of %d %s files", backends[backend].name,
+            st->loads[backend], st->tries[backend], format);
+    }
+    pthread_mutex_unlock(&stats_lock);
+}
+
+static bool load_backend(const struct decoder_backend* backend, struct decoder* dec,
+    const char* path, const char* options, int samplerate)
+{
+    if (backend->thread_safe)
+        return backend->load(dec, path, options, samplerate);
+    pthread_mutex_lock(&load_lock);
+    bool loaded = backend->load(dec, path, options, samplerate);
+    pthread_mutex_unlock(&load_lock);
+    return loaded;
+}
+
+// bass can't use the seek index, so files that have one, or are scanned to get one, go to
+// avcodec first. only formats avcodec builds an index for are checked.
+static void prefer_index(const struct format* fmt, const char* path, const char* options, int* order, int count)
+{
+    static const char* index_formats[] = {"mp3", "mpeg", "ac3"};
+    bool indexed = false;
+    for (int i = 0; i < COUNT(index_formats); i++)
+        indexed |= !strcmp(fmt->name, index_formats[i]);
+    if (!indexed || !(keyval_bool(options, "seek_index", false) || ff_has_index(path)))
+        return;
+    int backend = find_backend("ffmpeg");
+    for (int i = 1; backend >= 0 && i < count; i++) {
+        if (order[i] == backend) {
+            memmove(order + 1, order, i * sizeof *order);
+            order[0] = backend;
+            break;
+        }
+    }
+}
+
+bool decoder_load(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    int                     order[MAX_BACKENDS] = {0};
+    const struct format*    fmt                 = sniff(path);
+    int                     count               = backend_order(fmt, path, order);
+
+    prefer_index(fmt, path, options, order, count);
+    LOG_DEBUG("[decoder] '%s' looks like %s", path, fmt->name);
+    for (int i = 0; i < count; i++) {
+        bool loaded = load_backend(&backends[order[i]], dec, path, options, samplerate);
+        update_stats(fmt->name, order[i], loaded);
+        if (loaded)
+            return true;
+    }
+    return false;
+}
+
+bool decoder_register(const struct decoder_backend* backend)
+{
+    if (!backend->name || !backend->load) {
+        LOG_ERROR("[decoder] backend without name or load function");
+        return false;
+    }
+    if (find_backend(backend->name) >= 0) {
+        LOG_ERROR("[decoder] there already is a backend called %s", backend->name);
+        return false;
+    }
+    if (backend_count == MAX_BACKENDS) {
+        LOG_ERROR("[decoder] too many backends, can't add %s", backend->name);
+        return false;
+    }
+    backends[backend_count++] = *backend;
+    LOG_INFO("[decoder] added backend %s, priority %d%s", backend->name, backend->priority,
+        backend->thread_safe ? ", thread safe" : "");
+    return true;
+}
+
+static bool load_plugin(char* path)
+{
+    void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        LOG_ERROR("[decoder] can't load plugin: %s", dlerror());
+        return false;
+    }
+    bool (*init)(int, decoder_register_fn) = NULL;
+    // the cast is how posix wants it, function pointers can't be assigned from void*
+    *(void**)&init = dlsym(handle, "demosauce_decoder_plugin");
+    if (!init) {
+        LOG_ERROR("[decoder] %s is not a plugin", path);
+        dlclose(handle);
+        return false;
+    }
+    int count = backend_count;
+    if (!init(DECODER_API_VERSION, decoder_register)) {
+        LOG_ERROR("[decoder] plugin %s failed to start", path);
+        // the backends it did register still point into it
+        if (count == backend_count)
+            dlclose(handle);
+        return false;
+    }
+    // the plugin stays loaded until exit
+    LOG_INFO("[decoder] loaded plugin %s", path);
+    return true;
+}
+
+static bool set_priority(char* pair)
+{
+    char* value = strchr(pair, '=');
+    if (value)
+        *value++ = 0;
+    int i = find_backend(util_trim(pair));
+    if (i < 0 || !value) {
+        LOG_ERROR("[decoder] can't set priority of %s", pair);
+        return false;
+    }
+    backends[i].priority = atoi(value);
+    return true;
+}
+
+// calls <fn> for every item of a comma separated list, stops at the first failure
+static bool each_item(const char* list, bool (*fn)(char*))
+{
+    char*   copy    = util_strdup(list);
+    bool    ok      = true;
+    for (char* item = copy; ok && item;) {
+        char* next = strchr(item, ',');
+        if (next)
+            *next++ = 0;
+        item = util_trim(item);
+        if (*item)
+            ok = fn(item);
+        item = next;
+    }
+    free(copy);
+    return ok;
+}
+
+bool decoder_load_plugins(const char* paths)
+{
+    return each_item(paths, load_plugin);
+}
+
+bool decoder_set_priorities(const char* list)
+{
+    return each_item(list, set_priority);
+}
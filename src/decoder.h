@@ -0,0 +1,61 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef DECODER_H
+#define DECODER_H
+
+#include "util.h"
+
+#define DECODER_API_VERSION     1
+
+/*  a decoder backend. the strings and the formats list must stay valid as long as the
+ *  program runs. formats are the names the header sniffing finds: xm it s3m mtm mo3 umx mod
+ *  gzip zip wav aiff vorbis mp3 mpeg opus ogg flac mp4 wma ape wavpack mpc ra ac3 aac
+ */
+struct decoder_backend {
+    const char*     name;
+    int             priority;       // higher goes first
+    bool            thread_safe;    // load may run in several threads at once
+    bool            (*probe)(const char* path);     // true if the extension looks right
+    bool            (*load)(struct decoder* dec, const char* path, const char* options, int samplerate);
+    const char**    formats;        // tried first for these, NULL terminated, may be NULL
+};
+
+typedef bool (*decoder_register_fn)(const struct decoder_backend* backend);
+
+/*  plugins are shared objects that export this function. it's called once with
+ *  DECODER_API_VERSION and registers the backends. the functions in util.h can be used.
+ */
+bool demosauce_decoder_plugin(int api_version, decoder_register_fn register_backend);
+
+/*  picks the decoder for a file, so usually only one has to try to open it. bass and ffmpeg
+ *  are built in, with priority 10 and 0. registering and setting priorities must be done
+ *  before decoder_load is used.
+ *  decoder_register
+ *      adds a backend, returns false if there are too many or the name is taken
+ *  decoder_load_plugins
+ *      loads a comma separated list of plugin files, returns false if one fails
+ *  decoder_set_priorities
+ *      sets priorities from a comma separated list of name=priority pairs
+ *  decoder_load
+ *      looks at the first bytes of <path> to find out the format, the extension is used if
+ *      that doesn't work. backends that claim the format try first, the others after that,
+ *      each group by priority. a backend that keeps failing on a format is moved behind
+ *      one that loads it, after at least 8 tries of both. ffmpeg goes first for files with
+ *      a seek index, or with the seek_index option. loads of backends that aren't thread
+ *      safe are serialized. <options> are the per-song settings, <samplerate> is used by
+ *      decoders that can render at any rate. returns false if no decoder could load <path>.
+ */
+bool    decoder_register(const struct decoder_backend* backend);
+bool    decoder_load_plugins(const char* paths);
+bool    decoder_set_priorities(const char* list);
+bool    decoder_load(struct decoder* dec, const char* path, const char* options, int samplerate);
+
+#endif // DECODER_H
@@ -44,6 +44,7 @@
 #include "settings.h"
 #include "cast.h"
 #include "bassdecoder.h"
+#include "decoder.h"
 
 int main(int argc, char** argv)
 {
@@ -57,6 +58,10 @@ int main(int argc, char** argv)
     settings_init(argc, argv);
     log_set_console_level(settings_log_console_level);
     log_set_file(settings_log_file, settings_log_file_level);
+    if (!decoder_load_plugins(settings_decoder_plugins) || !decoder_set_priorities(settings_decoder_priority)) {
+        puts("failed to set up decoder plugins");
+        return EXIT_FAILURE;
+    }
     puts("The spice must flow!");
     cast_run();
     return EXIT_SUCCESS;
@@ -14,6 +14,9 @@
 #include <limits.h>
 #include <assert.h>
 #include <samplerate.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
 #include "effects.h"
 #include "log.h"
 
@@ -127,24 +130,24 @@ void fx_fade_init(struct fx_fade* fx, long start_frame, long end_frame, float be
 
 void fx_fade(struct fx_fade* fx, struct stream* s)
 {
-    long enda = (fx->start_frame < fx->current_frame) ? 0 :
-        MIN(s->frames, fx->start_frame - fx->current_frame);
-    long endb = (fx->end_frame < fx->current_frame) ? 0 :
-        MIN(s->frames, fx->end_frame - fx->current_frame);
+    // the stream has frames before the fade, frames in the fade and frames after it
+    long before = CLAMP(0, fx->start_frame - fx->current_frame, s->frames);
+    long during = CLAMP(0, fx->end_frame - fx->current_frame, s->frames) - before;
     fx->current_frame += s->frames;
-    if (fx->amp == 1 && (enda >= s->frames || endb == 0))
+    if (fx->amp == 1 && during <= 0)
         return; // nothing to do; amp mignt not be exacly on target, so proximity check would be better
-    float a = fx->amp;
     for (int ch = 0; ch < s->channels; ch++) {
         float* out = s->buffer[ch];
-        for (int i = 0; i < enda; i++)
+        float a = fx->amp;
+        long i = 0;
+        for (; i < before; i++)
             out[i] *= a;
-        for (int i = 0; i < endb; i++, a += fx->amp_inc)
+        for (; i < before + during; i++, a += fx->amp_inc)
+            out[i] *= a;
+        for (; i < s->frames; i++)
             out[i] *= a;
-        for (int i = 0; i < s->frames; i++)
-            *out++ *= a;
     }
-    fx->amp += fx->amp_inc * (endb - enda);
+    fx->amp += fx->amp_inc * MAX(0, during);
 }
 
 //-----------------------------------------------------------------------------
@@ -195,6 +198,24 @@ void fx_clip(struct stream* s)
 
 //-----------------------------------------------------------------------------
 
+float fx_peak(const float* samples, long frames)
+{
+    float   max = 0;
+    long    i   = 0;
+#ifdef __SSE2__
+    const __m128 sign = _mm_set1_ps(-0.f);
+    __m128  vmax = _mm_setzero_ps();
+    float   tmp[4];
+    for (; i + 4 <= frames; i += 4)
+        vmax = _mm_max_ps(vmax, _mm_andnot_ps(sign, _mm_loadu_ps(samples + i)));
+    _mm_storeu_ps(tmp, vmax);
+    max = MAX(MAX(tmp[0], tmp[1]), MAX(tmp[2], tmp[3]));
+#endif
+    for (; i < frames; i++)
+        max = MAX(max, fabsf(samples[i]));
+    return max;
+}
+
 static void ci16i(const void** vin, float** out, int len, int channels)
 {
     const int16_t* in = vin[0];
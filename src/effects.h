@@ -37,6 +37,9 @@ void    fx_gain(struct stream* s, float gain);
 
 void    fx_clip(struct stream* s);
 
+// returns the maximum absolute value of <samples>
+float   fx_peak(const float* samples, long frames);
+
 void    fx_map(struct stream* s, int channels);
 
 void*   fx_resample_init(int channels, int sr_from, int sr_to);
@@ -19,8 +19,10 @@
 // fixes missing UINT64_C macro on some distros
 #define __STDC_CONSTANT_MACROS
 
+#include <stdio.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
 #ifdef FFMPEG_OLD_HEADER
     #include <avcodec.h>
     #include <avformat.h>
@@ -37,8 +39,36 @@
 #endif
 
 #define BUFFER_SIZE (AVCODEC_MAX_AUDIO_FRAME_SIZE)
+#define SEEK_PREROLL    0.1     // seek this far in front of the target so the codec can settle, in seconds
+#define INDEX_INTERVAL  1       // time between two seek index entries, in seconds
+#define INDEX_VERSION   2
+#define INDEX_HEADER    40
+#define INDEX_SAMPLE    1024    // bytes at the start and end of the media file that are hashed
+#define INDEX_EXT       ".dsidx"
+#define IO_BUFFER       (64 * 1024)
+#define FAST_PROBESIZE  (32 * 1024)     // bytes avformat may read to find the stream parameters
+#define FAST_ANALYZE    1               // seconds
+
+// newer versions can read from a custom AVIOContext, local files are mapped into memory
+#define MAPPED_IO       (LIBAVFORMAT_VERSION_INT >= AV_VERSION_INT(53, 17, 0))
+
+// a seek index entry maps the first frame decoded from a packet to the packet's byte offset
+struct index_entry {
+    int64_t     frame;
+    int64_t     pos;
+};
+
+// must not move while avformat uses it, so it's not part of struct ffdecoder
+struct mapped_io {
+    struct mapping      map;
+    long                pos;
+#if MAPPED_IO
+    AVIOContext*        context;
+#endif
+};
 
 struct ffdecoder {
+    struct mapped_io*   io;
     AVFormatContext*    format_context;
     AVCodecContext*     codec_context;
     AVCodec*            codec;
@@ -51,8 +81,80 @@ struct ffdecoder {
     int                 stream_index;
     int                 format;
     long                frames;
+    bool                seeking;    // waiting for the first packet with a timestamp
+    long                target;     // frame a seek should land on
+    long                skip;       // decoded frames to drop until the target is reached
+    bool                indexing;   // decoding from the start, the seek index is built on the way
+    long                decoded;    // frames decoded so far, only valid while indexing
+    struct buffer       index;      // struct index_entry, sorted by frame
 };
 
+#if MAPPED_IO
+static int io_read(void* opaque, uint8_t* buf, int size)
+{
+    struct mapped_io* io = opaque;
+    int bytes = MIN(size, io->map.size - io->pos);
+    if (bytes <= 0)
+        return AVERROR_EOF;
+    memcpy(buf, (const uint8_t*)io->map.data + io->pos, bytes);
+    io->pos += bytes;
+    return bytes;
+}
+
+static int64_t io_seek(void* opaque, int64_t offset, int whence)
+{
+    struct mapped_io* io = opaque;
+    int64_t pos = 0;
+    switch (whence & ~AVSEEK_FORCE) {
+    case AVSEEK_SIZE:   return io->map.size;
+    case SEEK_SET:      pos = offset; break;
+    case SEEK_CUR:      pos = io->pos + offset; break;
+    case SEEK_END:      pos = io->map.size + offset; break;
+    default:            return -1;
+    }
+    if (pos < 0 || pos > io->map.size)
+        return -1;
+    io->pos = pos;
+    return pos;
+}
+#endif
+
+// returns NULL if the file can't be mapped, avformat will open it the usual way then.
+// zipped and gzipped files are unpacked.
+static struct mapped_io* io_open(const char* path)
+{
+#if MAPPED_IO
+    struct mapped_io*   io      = calloc(1, sizeof *io);
+    unsigned char*      buffer  = av_malloc(IO_BUFFER);
+    if (!io || !buffer || !util_load_file(&io->map, path, UNPACK_LIMIT))
+        goto error;
+    io->context = avio_alloc_context(buffer, IO_BUFFER, 0, io, io_read, NULL, io_seek);
+    if (!io->context)
+        goto error;
+    return io;
+
+error:
+    av_free(buffer);
+    if (io)
+        util_unmap_file(&io->map);
+    free(io);
+#endif
+    return NULL;
+}
+
+static void io_close(struct mapped_io* io)
+{
+    if (!io)
+        return;
+#if MAPPED_IO
+    // avformat may have replaced the buffer
+    av_free(io->context->buffer);
+    av_free(io->context);
+#endif
+    util_unmap_file(&io->map);
+    free(io);
+}
+
 static int get_format(AVCodecContext* codec_context)
 {
     switch (codec_context->sample_fmt) {
@@ -71,10 +173,37 @@ static int get_format(AVCodecContext* codec_context)
     };
 }
 
+// converts a timestamp of the audio stream into a frame number
+static long timestamp_to_frame(struct ffdecoder* d, int64_t timestamp)
+{
+    AVStream* stream = d->format_context->streams[d->stream_index];
+    AVRational frame_base = {1, d->codec_context->sample_rate};
+    if (stream->start_time != AV_NOPTS_VALUE)
+        timestamp -= stream->start_time;
+    return av_rescale_q(timestamp, stream->time_base, frame_base);
+}
+
+// the first frame decoded after a seek tells where it landed, everything up to the target is
+// dropped. the frame's timestamp is used rather than the packet's, codecs with a delay don't
+// return the samples of the packet they were given.
+static void seek_landed(struct ffdecoder* d, int64_t timestamp)
+{
+    d->seeking = false;
+    if (timestamp == AV_NOPTS_VALUE) {
+        LOG_DEBUG("[ffdecoder] no timestamp after seek, position is not accurate");
+        return;
+    }
+    long position = timestamp_to_frame(d, timestamp) - d->stream.frames;
+    d->skip = MAX(0, d->target - position);
+    if (position > d->target)
+        LOG_DEBUG("[ffdecoder] seek landed %ld frames after target", position - d->target);
+}
+
 static void decode_frame(struct ffdecoder* d, AVPacket* p)
 {
-    void* packet_data = p->data;
-    int   packet_size = p->size;
+    void*   packet_data = p->data;
+    int     packet_size = p->size;
+    int64_t timestamp   = p->pts != AV_NOPTS_VALUE ? p->pts : p->dts;
 
     while (p->size > 0) {
         int ret = 0;
@@ -91,7 +220,11 @@ static void decode_frame(struct ffdecoder* d, AVPacket* p)
         // TODO check format
         int frames = data_size / (d->codec_context->channels * sizeof (int16_t));
         void* buffs[MAX_CHANNELS] = {buf, buf + frames};
+        // old avcodec doesn't tell the timestamp of the output, the packet's has to do
+        if (d->seeking && frames > 0)
+            seek_landed(d, timestamp);
         stream_append_convert(&d->stream, buffs, d->format, frames, d->codec_context->channels);
+        d->decoded += frames;
 #else
         int got_frame = 0;
         AVFrame frame = {{0}};
@@ -100,8 +233,16 @@ static void decode_frame(struct ffdecoder* d, AVPacket* p)
             goto error;
         int frames = frame.nb_samples;
         void** buffs = (void**)frame.extended_data;
+        if (d->seeking)
+            seek_landed(d, frame.best_effort_timestamp != AV_NOPTS_VALUE ? frame.best_effort_timestamp : timestamp);
         stream_append_convert(&d->stream, buffs, d->format, frames, d->codec_context->channels);
+        d->decoded += frames;
 #endif
+        if (d->skip > 0) {
+            long drop = MIN(d->skip, d->stream.frames);
+            stream_drop(&d->stream, drop);
+            d->skip -= drop;
+        }
         p->data += ret;
         p->size -= ret;
     }
@@ -111,6 +252,215 @@ error:
     p->size = packet_size;
 }
 
+//-----------------------------------------------------------------------------
+
+// containers without a seek table make avcodec guess positions from the bitrate or read
+// the whole file. scan can save an index of byte offsets built during a full decode, which
+// is loaded with the file. it's only used for codecs where every packet decodes to the same
+// frames no matter where decoding started, others would drift by the codec delay.
+static bool index_supported(struct ffdecoder* d)
+{
+#if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(54, 25, 0)
+    enum CodecID id = d->codec->id;
+    return id == CODEC_ID_MP2 || id == CODEC_ID_MP3 || id == CODEC_ID_AC3;
+#else
+    enum AVCodecID id = d->codec->id;
+    return id == AV_CODEC_ID_MP2 || id == AV_CODEC_ID_MP3 || id == AV_CODEC_ID_AC3;
+#endif
+}
+
+static long index_count(struct ffdecoder* d)
+{
+    return d->index.size / sizeof (struct index_entry);
+}
+
+// called for every packet of the audio stream before it's decoded
+static void index_add(struct ffdecoder* d, int64_t pos)
+{
+    struct buffer* b = &d->index;
+    long count = index_count(d);
+    struct index_entry* last = count ? (struct index_entry*)b->data + count - 1 : NULL;
+    if (pos < 0 || (last && d->decoded - last->frame < INDEX_INTERVAL * d->codec_context->sample_rate))
+        return;
+    if (b->size + (long)sizeof (struct index_entry) > b->max_size) {
+        long size = b->size;
+        buffer_resize(b, MAX(4096, b->max_size * 2));
+        b->size = size;
+    }
+    struct index_entry* e = (struct index_entry*)((char*)b->data + b->size);
+    e->frame = d->decoded;
+    e->pos   = pos;
+    b->size += sizeof (struct index_entry);
+}
+
+// returns the last entry at or before <frame>, or NULL
+static struct index_entry* index_find(struct ffdecoder* d, long frame)
+{
+    struct index_entry* entries = d->index.data;
+    long lo = 0;
+    long hi = index_count(d);
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (entries[mid].frame <= frame)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo ? entries + lo - 1 : NULL;
+}
+
+static void write_int(unsigned char* buf, int64_t v, int size)
+{
+    for (int i = 0; i < size; i++)
+        buf[i] = (v >> (i * 8)) & 255;
+}
+
+static int64_t read_int(const unsigned char* buf, int size)
+{
+    uint64_t v = 0;
+    for (int i = size - 1; i >= 0; i--)
+        v = v << 8 | buf[i];
+    return v;
+}
+
+static char* index_path(const char* path)
+{
+    char* index_path = malloc(strlen(path) + sizeof INDEX_EXT);
+    if (index_path)
+        strcat(strcpy(index_path, path), INDEX_EXT);
+    return index_path;
+}
+
+// size, modification time and a hash of the first and last INDEX_SAMPLE bytes. retagging
+// often keeps the size because of id3 padding, but it changes the tags at either end.
+static bool fingerprint(const char* path, unsigned char* out)
+{
+    struct stat     st      = {0};
+    unsigned char   buf[INDEX_SAMPLE];
+    uint64_t        h       = 0xcbf29ce484222325ull;
+    FILE*           f       = NULL;
+
+    if (stat(path, &st) || !(f = fopen(path, "rb")))
+        return false;
+    for (int part = 0; part < 2; part++) {
+        long offset = part ? MAX(0, (long)st.st_size - INDEX_SAMPLE) : 0;
+        size_t n = fseek(f, offset, SEEK_SET) ? 0 : fread(buf, 1, sizeof buf, f);
+        for (size_t i = 0; i < n; i++) {
+            h ^= buf[i];
+            h *= 0x100000001b3ull;
+        }
+    }
+    fclose(f);
+    write_int(out, st.st_size, 8);
+    write_int(out + 8, st.st_mtime, 8);
+    write_int(out + 16, h, 8);
+    return true;
+}
+
+// the header is "DSSI", version and samplerate as 32 bit, 4 reserved bytes and the
+// fingerprint of the media file, so a stale index is ignored. it's followed by frame and
+// byte offset of each entry as 64 bit. all little endian. returns the index file after the
+// header, or NULL if there is none or it's stale.
+static FILE* index_open(const char* path, unsigned char* header)
+{
+    unsigned char   print[24]   = {0};
+    char*           file_name   = index_path(path);
+    FILE*           f           = file_name ? fopen(file_name, "rb") : NULL;
+
+    free(file_name);
+    if (!f)
+        return NULL;
+    if (fread(header, 1, INDEX_HEADER, f) != INDEX_HEADER || memcmp(header, "DSSI", 4))
+        goto error;
+    if (read_int(header + 4, 4) != INDEX_VERSION)
+        goto error;
+    if (!fingerprint(path, print) || memcmp(header + 16, print, sizeof print))
+        goto error;
+    return f;
+
+error:
+    fclose(f);
+    return NULL;
+}
+
+static void index_load(struct ffdecoder* d, const char* path)
+{
+    unsigned char   header[INDEX_HEADER] = {0};
+    FILE*           f           = index_open(path, header);
+    long            count       = 0;
+
+    if (!f || read_int(header + 8, 4) != d->codec_context->sample_rate)
+        goto error;
+    if (fseek(f, 0, SEEK_END) || (count = (ftell(f) - INDEX_HEADER) / 16) <= 0 || fseek(f, INDEX_HEADER, SEEK_SET))
+        goto error;
+    buffer_resize(&d->index, count * sizeof (struct index_entry));
+    struct index_entry* entries = d->index.data;
+    for (long i = 0; i < count; i++) {
+        unsigned char buf[16];
+        if (fread(buf, 1, 16, f) != 16)
+            goto error;
+        entries[i].frame = read_int(buf, 8);
+        entries[i].pos   = read_int(buf + 8, 8);
+    }
+    LOG_DEBUG("[ffdecoder] loaded seek index with %ld entries", count);
+    fclose(f);
+    return;
+
+error:
+    d->index.size = 0;
+    if (f)
+        fclose(f);
+}
+
+bool ff_has_index(const char* path)
+{
+    unsigned char header[INDEX_HEADER];
+    FILE* f = index_open(path, header);
+    bool found = f;
+    if (f)
+        fclose(f);
+    return found;
+}
+
+bool ff_save_index(struct decoder* dec, const char* path)
+{
+    struct ffdecoder*   d           = dec->handle;
+    unsigned char       header[INDEX_HEADER] = {0};
+    char*               file_name   = NULL;
+    FILE*               f           = NULL;
+    struct index_entry* entries     = d->index.data;
+    bool                ok          = false;
+
+    // only an index built by decoding the whole file is complete
+    if (!d->indexing || !d->stream.end_of_stream || !index_count(d))
+        goto error;
+    file_name = index_path(path);
+    f = file_name ? fopen(file_name, "wb") : NULL;
+    if (!f)
+        goto error;
+
+    memcpy(header, "DSSI", 4);
+    write_int(header + 4, INDEX_VERSION, 4);
+    write_int(header + 8, d->codec_context->sample_rate, 4);
+    ok = fingerprint(path, header + 16) && fwrite(header, 1, INDEX_HEADER, f) == INDEX_HEADER;
+    for (long i = 0; ok && i < index_count(d); i++) {
+        unsigned char buf[16];
+        write_int(buf, entries[i].frame, 8);
+        write_int(buf + 8, entries[i].pos, 8);
+        ok = fwrite(buf, 1, 16, f) == 16;
+    }
+    if (fclose(f))
+        ok = false;
+    if (!ok)
+        remove(file_name);
+
+error:
+    free(file_name);
+    return ok;
+}
+
+//-----------------------------------------------------------------------------
+
 static void ff_decode(struct decoder* dec, struct stream* s, int frames)
 {
     struct ffdecoder* d = dec->handle;
@@ -125,8 +475,11 @@ static void ff_decode(struct decoder* dec, struct stream* s, int frames)
             d->stream.end_of_stream = true;
             break;
         }
-        if (packet.stream_index == d->stream_index)
+        if (packet.stream_index == d->stream_index) {
+            if (d->indexing)
+                index_add(d, packet.pos);
             decode_frame(d, &packet);
+        }
         av_free_packet(&packet);
     }
 
@@ -138,13 +491,35 @@ static void ff_decode(struct decoder* dec, struct stream* s, int frames)
         LOG_DEBUG("[ffdecoder] eos avcodec %d frames left", s->frames);
 }
 
+// seeks to the keyframe before the target in the audio stream's time base, then decodes
+// and drops frames until the target is reached
 static void ff_seek(struct decoder* dec, long frame)
 {
     struct ffdecoder* d = dec->handle;
-    int sr = d->codec_context->sample_rate;
-    int64_t timestamp = frame / sr * AV_TIME_BASE;
-    if (av_seek_frame(d->format_context, -1, timestamp, 0) < 0)
+    AVStream* stream = d->format_context->streams[d->stream_index];
+    AVRational frame_base = {1, d->codec_context->sample_rate};
+    long preroll = MIN(frame, (long)(SEEK_PREROLL * d->codec_context->sample_rate));
+    int64_t timestamp = av_rescale_q(frame - preroll, frame_base, stream->time_base);
+    if (stream->start_time != AV_NOPTS_VALUE)
+        timestamp += stream->start_time;
+
+    // with a seek index the position is known exactly, no need to look at timestamps
+    struct index_entry* entry = index_find(d, frame - preroll);
+    if (entry && av_seek_frame(d->format_context, d->stream_index, entry->pos, AVSEEK_FLAG_BYTE) >= 0) {
+        d->seeking  = false;
+        d->skip     = frame - entry->frame;
+    } else if (av_seek_frame(d->format_context, d->stream_index, timestamp, AVSEEK_FLAG_BACKWARD) >= 0) {
+        d->seeking  = true;
+        d->skip     = 0;
+    } else {
         LOG_WARN("[ffdecoder] seek failed");
+        return;
+    }
+    avcodec_flush_buffers(d->codec_context);
+    d->stream.frames        = 0;
+    d->stream.end_of_stream = false;
+    d->target               = frame;
+    d->indexing             = false;
 }
 
 static const char* codec_type(struct ffdecoder* d)
@@ -262,6 +637,7 @@ static void ff_free2(struct ffdecoder* d)
     buffer_free(&d->buffer);
 #endif
     stream_free(&d->stream);
+    buffer_free(&d->index);
     if (d->codec_context)
         avcodec_close(d->codec_context);
     if (d->format_context)
@@ -270,6 +646,7 @@ static void ff_free2(struct ffdecoder* d)
 #else
         avformat_close_input(&d->format_context);
 #endif
+    io_close(d->io);
 }
 
 static void ff_free(struct decoder* dec)
@@ -280,66 +657,110 @@ static void ff_free(struct decoder* dec)
     memset(dec, 0, sizeof *dec);
 }
 
-bool ff_load(struct decoder* dec, const char* path)
+// a fast open reads only a small part of the file to find the stream parameters. with a
+// <format> avformat doesn't have to guess the format either.
+static bool open_input(struct ffdecoder* d, const char* path, AVInputFormat* format, bool fast)
 {
-    // TODO reject input files with low score
-    static bool initialized = false;
-    if (!initialized) {
-        initialized = true;
-        av_register_all();
-#if LIBAVFORMAT_VERSION_INT > AV_VERSION_INT(53, 18, 0)
-        avformat_network_init();
-#endif
-#ifndef DEBUG
-        av_log_set_level(AV_LOG_QUIET);
-#endif
-    }
-
-    LOG_DEBUG("[ffdecoder] loading %s", path);
-
     int err = 0;
-    struct ffdecoder d = {0};
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(52, 111, 0)
-    err = av_open_input_file(&d.format_context, path, 0, 0, 0);
+    err = av_open_input_file(&d->format_context, path, format, 0, 0);
 #else
-    err = avformat_open_input(&d.format_context, path, 0, 0);
+#if MAPPED_IO
+    d->io = io_open(path);
+#endif
+    d->format_context = avformat_alloc_context();
+    if (!d->format_context)
+        return false;
+#if MAPPED_IO
+    if (d->io)
+        d->format_context->pb = d->io->context;
+#endif
+    if (fast) {
+        d->format_context->probesize = FAST_PROBESIZE;
+        d->format_context->max_analyze_duration = FAST_ANALYZE * AV_TIME_BASE;
+    }
+    err = avformat_open_input(&d->format_context, path, format, 0);
 #endif
     if (err)
-        goto error;
+        return false;
 #if LIBAVFORMAT_VERSION_INT < AV_VERSION_INT(53, 6, 0)
-    err = av_find_stream_info(d.format_context);
+    err = av_find_stream_info(d->format_context);
 #else
-    err = avformat_find_stream_info(d.format_context, NULL);
+    err = avformat_find_stream_info(d->format_context, NULL);
 #endif
     if (err < 0)
-        goto error;
+        return false;
 
-    for (unsigned i = 0; i < d.format_context->nb_streams; i++) {
+    d->stream_index = -1;
+    for (unsigned i = 0; i < d->format_context->nb_streams; i++) {
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(52, 64, 0)
-        if (d.format_context->streams[i]->codec->codec_type == CODEC_TYPE_AUDIO)
+        if (d->format_context->streams[i]->codec->codec_type == CODEC_TYPE_AUDIO) {
 #else
-        if (d.format_context->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO)
+        if (d->format_context->streams[i]->codec->codec_type == AVMEDIA_TYPE_AUDIO) {
 #endif
-            d.stream_index = i;
+            d->stream_index = i;
             break;
+        }
     }
-    if (d.stream_index == -1)
-        goto error;
+    if (d->stream_index == -1)
+        return false;
 
-    d.codec_context = d.format_context->streams[d.stream_index]->codec;
-    d.codec = avcodec_find_decoder(d.codec_context->codec_id);
-    if (!d.codec)
-        goto error;
+    d->codec_context = d->format_context->streams[d->stream_index]->codec;
+    d->codec = avcodec_find_decoder(d->codec_context->codec_id);
+    if (!d->codec)
+        return false;
 
-    d.format = get_format(d.codec_context);
-    if (d.format < 0)
-        goto error;
+    // a short probe may not have seen enough to know these
+    if (d->codec_context->sample_rate <= 0 || d->codec_context->channels <= 0)
+        return false;
+
+    d->format = get_format(d->codec_context);
+    if (d->format < 0)
+        return false;
 
 #if LIBAVCODEC_VERSION_INT < AV_VERSION_INT(53, 8, 0)
-    if (avcodec_open(d.codec_context, d.codec) < 0)
+    return avcodec_open(d->codec_context, d->codec) >= 0;
 #else
-    if (avcodec_open2(d.codec_context, d.codec, NULL) < 0)
+    return avcodec_open2(d->codec_context, d->codec, NULL) >= 0;
+#endif
+}
+
+bool ff_load(struct decoder* dec, const char* path, const char* options)
+{
+    // TODO reject input files with low score
+    static bool initialized = false;
+    if (!initialized) {
+        initialized = true;
+        av_register_all();
+#if LIBAVFORMAT_VERSION_INT > AV_VERSION_INT(53, 18, 0)
+        avformat_network_init();
+#endif
+#ifndef DEBUG
+        av_log_set_level(AV_LOG_QUIET);
 #endif
+    }
+
+    LOG_DEBUG("[ffdecoder] loading %s", path);
+
+    struct ffdecoder    d                   = {0};
+    AVInputFormat*      format              = NULL;
+    char                format_name[32]     = {0};
+    double              start               = util_time();
+    bool                fast                = keyval_bool(options, "fast_open", true);
+
+    keyval_str(format_name, sizeof format_name, options, "format", "");
+    if (*format_name && !(format = av_find_input_format(format_name)))
+        LOG_WARN("[ffdecoder] unknown format '%s'", format_name);
+
+    // the fast way is tried first, if that doesn't work the whole file is probed
+    bool quick = fast || format;
+    bool loaded = quick && open_input(&d, path, format, fast);
+    if (!loaded && quick) {
+        LOG_DEBUG("[ffdecoder] fast open failed, probing %s", path);
+        ff_free2(&d);
+        memset(&d, 0, sizeof d);
+    }
+    if (!loaded && !open_input(&d, path, NULL, false))
         goto error;
 
     if (d.format_context->duration > 0)
@@ -349,6 +770,12 @@ bool ff_load(struct decoder* dec, const char* path)
     buffer_resize(&d.buffer, BUFFER_SIZE);
 #endif
 
+    // building an index costs memory for every packet, only scan asks for it
+    if (index_supported(&d)) {
+        index_load(&d, path);
+        d.indexing = !index_count(&d) && keyval_bool(options, "seek_index", false);
+    }
+
     dec->free       = ff_free;
     dec->seek       = ff_seek;
     dec->info       = ff_info;
@@ -357,7 +784,7 @@ bool ff_load(struct decoder* dec, const char* path)
     dec->handle     = calloc(1, sizeof (struct ffdecoder));
     memmove(dec->handle, &d, sizeof (struct ffdecoder));
 
-    LOG_INFO("[ffdecoder] loaded %s", path);
+    LOG_INFO("[ffdecoder] loaded %s in %.0f ms", path, (util_time() - start) * 1000);
     return true;
 
 error:
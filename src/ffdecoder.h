@@ -13,8 +13,26 @@
 
 #include "util.h"
 
-bool    ff_probe(const char* filename);
-bool    ff_load(struct decoder* dec, const char* file_name);
+bool    ff_probe_name(const char* file_name);
+
+/*  ff_load
+ *      opens <file_name>. <options> is a set of key-value pairs, may be NULL. fast_open
+ *      (default true) limits how much of the file is read to find the stream parameters,
+ *      format is the name of an avformat demuxer that is used without probing. if either
+ *      doesn't work the file is probed the usual way. seek_index (default false) builds a
+ *      seek index while the file is decoded, for ff_save_index.
+ */
+bool    ff_load(struct decoder* dec, const char* file_name, const char* options);
+
+/*  ff_save_index
+ *      writes a seek index next to <file_name>, which is loaded by ff_load from then on.
+ *      only works if it was loaded with seek_index and decoded from start to end without
+ *      seeking, and not for every codec. returns true if the index was written.
+ *  ff_has_index
+ *      true if <file_name> has a seek index that is up to date.
+ */
+bool    ff_save_index(struct decoder* dec, const char* file_name);
+bool    ff_has_index(const char* file_name);
 
 #endif // FFDECODER_H
 
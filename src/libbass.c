@@ -100,6 +100,9 @@ static bool load(const char* file)
 
 bool bass_loadso(void)
 {
+    // already loaded, this is called for every file by the scan library
+    if (handle)
+        return !error;
     // try linker search first, incl. LD_LIBRARY_PATH
     if (load("libbass.so"))
         return true;
@@ -0,0 +1,380 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
+#include "loudness.h"
+#include "effects.h"
+#include "log.h"
+
+#define ABS_GATE        -70.0   // LUFS
+#define REL_GATE        -10.0   // LU, for integrated loudness
+#define LRA_GATE        -20.0   // LU, for loudness range
+#define HIST_STEP       0.1     // LU
+#define HIST_SIZE       800     // covers ABS_GATE to +10 LUFS
+#define MOMENTARY_STEPS 4       // 400 ms blocks for integrated loudness
+#define SHORTTERM_STEPS 30      // 3 s blocks for loudness range
+#define TP_FACTOR       4       // true peak oversampling, the SSE version needs 4
+#define TP_TAPS         12      // filter taps per phase
+#define TP_HISTORY      (TP_TAPS - 1)
+#define TP_BLOCK        32      // true peak is skipped for blocks that can't exceed the peak
+#define PI              3.14159265358979323846
+
+// blocks are stored in a histogram with 0.1 LU resolution, so gating doesn't need to keep
+// a list of all blocks. the energy is summed per bin, only the relative gate is rounded.
+struct histogram {
+    long        count[HIST_SIZE];
+    double      energy[HIST_SIZE];
+};
+
+struct loudness {
+    int         channels;
+    long        step_frames;                // 100 ms
+    long        step_pos;
+    long        step_count;
+    double      step_energy[2];             // sum of squares in the current step per channel
+    double      steps[SHORTTERM_STEPS];     // mean square of the last steps
+    double      coef[2][5];                 // b0 b1 b2 a1 a2 of pre-filter and RLB filter
+    double      state[2][2][2];             // [filter][delay][channel]
+    float       tp_coef[TP_TAPS][TP_FACTOR];
+    float       tp_gain;                    // maximum gain of any phase
+    float*      tp_buffer[MAX_CHANNELS];    // TP_HISTORY samples followed by the current data
+    long        tp_frames;
+    float       peak;
+    struct histogram momentary;
+    struct histogram shortterm;
+};
+
+static double energy_to_lufs(double energy)
+{
+    return -0.691 + 10 * log10(energy);
+}
+
+static void histogram_add(struct histogram* h, double energy)
+{
+    double lufs = energy_to_lufs(energy + 1e-30);
+    if (lufs <= ABS_GATE)
+        return;
+    int i = CLAMP(0, (int)((lufs - ABS_GATE) / HIST_STEP), HIST_SIZE - 1);
+    h->count[i]++;
+    h->energy[i] += energy;
+}
+
+// returns the first bin above the relative gate
+static int histogram_gate(struct histogram* h, double gate)
+{
+    long    count   = 0;
+    double  energy  = 0;
+    for (int i = 0; i < HIST_SIZE; i++) {
+        count  += h->count[i];
+        energy += h->energy[i];
+    }
+    if (!count)
+        return HIST_SIZE;
+    gate += energy_to_lufs(energy / count);
+    return CLAMP(0, (int)ceil((gate - ABS_GATE) / HIST_STEP - 0.5), HIST_SIZE);
+}
+
+//-----------------------------------------------------------------------------
+
+// K-weighting filter coefficients for arbitrary samplerates, the constants are the analog
+// prototypes fitted to the 48 khz coefficients in BS.1770
+static void kfilter_init(struct loudness* l, int samplerate)
+{
+    double k    = tan(PI * 1681.974450955533 / samplerate);
+    double q    = 0.7071752369554196;
+    double vh   = pow(10, 3.999843853973347 / 20);
+    double vb   = pow(vh, 0.4996667741545416);
+    double a0   = 1 + k / q + k * k;
+    l->coef[0][0] = (vh + vb * k / q + k * k) / a0;
+    l->coef[0][1] = 2 * (k * k - vh) / a0;
+    l->coef[0][2] = (vh - vb * k / q + k * k) / a0;
+    l->coef[0][3] = 2 * (k * k - 1) / a0;
+    l->coef[0][4] = (1 - k / q + k * k) / a0;
+
+    k   = tan(PI * 38.13547087602444 / samplerate);
+    q   = 0.5003270373238773;
+    a0  = 1 + k / q + k * k;
+    l->coef[1][0] = 1;
+    l->coef[1][1] = -2;
+    l->coef[1][2] = 1;
+    l->coef[1][3] = 2 * (k * k - 1) / a0;
+    l->coef[1][4] = (1 - k / q + k * k) / a0;
+}
+
+// both channels run through the same filters, the SSE version puts them in two lanes.
+// the filters are transposed direct form II biquads in double precision.
+#ifdef __SSE2__
+static void kfilter(struct loudness* l, const float* left, const float* right, long frames)
+{
+    __m128d c[2][5];
+    __m128d z[2][2];
+    __m128d sum = _mm_loadu_pd(l->step_energy);
+
+    for (int f = 0; f < 2; f++) {
+        for (int i = 0; i < 5; i++)
+            c[f][i] = _mm_set1_pd(l->coef[f][i]);
+        z[f][0] = _mm_loadu_pd(l->state[f][0]);
+        z[f][1] = _mm_loadu_pd(l->state[f][1]);
+    }
+    for (long i = 0; i < frames; i++) {
+        __m128d x = _mm_set_pd(right[i], left[i]);
+        for (int f = 0; f < 2; f++) {
+            __m128d y = _mm_add_pd(_mm_mul_pd(c[f][0], x), z[f][0]);
+            z[f][0] = _mm_sub_pd(_mm_add_pd(_mm_mul_pd(c[f][1], x), z[f][1]), _mm_mul_pd(c[f][3], y));
+            z[f][1] = _mm_sub_pd(_mm_mul_pd(c[f][2], x), _mm_mul_pd(c[f][4], y));
+            x = y;
+        }
+        sum = _mm_add_pd(sum, _mm_mul_pd(x, x));
+    }
+    for (int f = 0; f < 2; f++) {
+        _mm_storeu_pd(l->state[f][0], z[f][0]);
+        _mm_storeu_pd(l->state[f][1], z[f][1]);
+    }
+    _mm_storeu_pd(l->step_energy, sum);
+}
+#else
+static void kfilter(struct loudness* l, const float* left, const float* right, long frames)
+{
+    for (long i = 0; i < frames; i++) {
+        double x[2] = {left[i], right[i]};
+        for (int f = 0; f < 2; f++) {
+            double* c = l->coef[f];
+            for (int ch = 0; ch < 2; ch++) {
+                double y = c[0] * x[ch] + l->state[f][0][ch];
+                l->state[f][0][ch] = c[1] * x[ch] - c[3] * y + l->state[f][1][ch];
+                l->state[f][1][ch] = c[2] * x[ch] - c[4] * y;
+                x[ch] = y;
+            }
+        }
+        l->step_energy[0] += x[0] * x[0];
+        l->step_energy[1] += x[1] * x[1];
+    }
+}
+#endif
+
+static void finish_step(struct loudness* l)
+{
+    double energy = l->step_energy[0];
+    if (l->channels == 2)
+        energy += l->step_energy[1];
+    l->steps[l->step_count % SHORTTERM_STEPS] = energy / l->step_frames;
+    l->step_count++;
+    l->step_energy[0] = l->step_energy[1] = 0;
+    l->step_pos = 0;
+
+    // blocks overlap by all but one step
+    if (l->step_count >= MOMENTARY_STEPS) {
+        double sum = 0;
+        for (int i = 1; i <= MOMENTARY_STEPS; i++)
+            sum += l->steps[(l->step_count - i) % SHORTTERM_STEPS];
+        histogram_add(&l->momentary, sum / MOMENTARY_STEPS);
+    }
+    if (l->step_count >= SHORTTERM_STEPS) {
+        double sum = 0;
+        for (int i = 0; i < SHORTTERM_STEPS; i++)
+            sum += l->steps[i];
+        histogram_add(&l->shortterm, sum / SHORTTERM_STEPS);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+// polyphase interpolation filter, windowed sinc with the cutoff at the input nyquist.
+// each phase is normalized to unity gain.
+static void true_peak_init(struct loudness* l)
+{
+    const int n = TP_TAPS * TP_FACTOR;
+    for (int p = 0; p < TP_FACTOR; p++) {
+        float sum = 0;
+        for (int k = 0; k < TP_TAPS; k++) {
+            int     i   = k * TP_FACTOR + p;
+            double  t   = (i - (n - 1) / 2.) / TP_FACTOR;
+            double  w   = 0.42 - 0.5 * cos(2 * PI * (i + .5) / n) + 0.08 * cos(4 * PI * (i + .5) / n);
+            l->tp_coef[k][p] = (float)(w * sin(PI * t) / (PI * t));
+            sum += l->tp_coef[k][p];
+        }
+        float gain = 0;
+        for (int k = 0; k < TP_TAPS; k++) {
+            l->tp_coef[k][p] /= sum;
+            gain += fabsf(l->tp_coef[k][p]);
+        }
+        l->tp_gain = MAX(l->tp_gain, gain);
+    }
+}
+
+// <x> points to the first new sample, TP_HISTORY older samples must be in front of it.
+// the SSE version computes all phases for four frames at once.
+static float true_peak(struct loudness* l, const float* x, long frames, float peak)
+{
+#ifdef __SSE2__
+    const __m128 sign = _mm_set1_ps(-0.f);
+    __m128  c[TP_TAPS][TP_FACTOR];
+    float   tmp[4];
+    for (int k = 0; k < TP_TAPS; k++)
+        for (int p = 0; p < TP_FACTOR; p++)
+            c[k][p] = _mm_set1_ps(l->tp_coef[k][p]);
+#endif
+    for (long block = 0; block < frames; block += TP_BLOCK) {
+        long end = MIN(frames, block + TP_BLOCK);
+        if (fx_peak(x + block - TP_HISTORY, TP_HISTORY + end - block) * l->tp_gain <= peak)
+            continue;
+        long i = block;
+#ifdef __SSE2__
+        __m128 max = _mm_set1_ps(peak);
+        for (; i + 4 <= end; i += 4) {
+            __m128 in   = _mm_loadu_ps(x + i);
+            __m128 acc0 = _mm_mul_ps(c[0][0], in);
+            __m128 acc1 = _mm_mul_ps(c[0][1], in);
+            __m128 acc2 = _mm_mul_ps(c[0][2], in);
+            __m128 acc3 = _mm_mul_ps(c[0][3], in);
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, in));
+            for (int k = 1; k < TP_TAPS; k++) {
+                in   = _mm_loadu_ps(x + i - k);
+                acc0 = _mm_add_ps(acc0, _mm_mul_ps(c[k][0], in));
+                acc1 = _mm_add_ps(acc1, _mm_mul_ps(c[k][1], in));
+                acc2 = _mm_add_ps(acc2, _mm_mul_ps(c[k][2], in));
+                acc3 = _mm_add_ps(acc3, _mm_mul_ps(c[k][3], in));
+            }
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, acc0));
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, acc1));
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, acc2));
+            max = _mm_max_ps(max, _mm_andnot_ps(sign, acc3));
+        }
+        _mm_storeu_ps(tmp, max);
+        peak = MAX(MAX(tmp[0], tmp[1]), MAX(tmp[2], tmp[3]));
+#endif
+        for (; i < end; i++) {
+            for (int p = 0; p < TP_FACTOR; p++) {
+                float acc = 0;
+                for (int k = 0; k < TP_TAPS; k++)
+                    acc += l->tp_coef[k][p] * x[i - k];
+                peak = MAX(peak, fabsf(acc));
+            }
+            peak = MAX(peak, fabsf(x[i]));
+        }
+    }
+    return peak;
+}
+
+//-----------------------------------------------------------------------------
+
+void* loudness_init(int channels, int samplerate)
+{
+    assert(channels >= 1 && channels <= MAX_CHANNELS);
+    if (samplerate < 1000) {
+        LOG_ERROR("[loudness] unsupported samplerate %d", samplerate);
+        return NULL;
+    }
+    struct loudness* l = util_malloc(sizeof *l);
+    if (!l)
+        return NULL;
+    memset(l, 0, sizeof *l);
+    l->channels     = channels;
+    l->step_frames  = (samplerate + 5) / 10;
+    kfilter_init(l, samplerate);
+    true_peak_init(l);
+    LOG_DEBUG("[loudness] init, %d channels, %d hz", channels, samplerate);
+    return l;
+}
+
+void loudness_free(void* handle)
+{
+    struct loudness* l = handle;
+    if (!l)
+        return;
+    for (int ch = 0; ch < MAX_CHANNELS; ch++)
+        free(l->tp_buffer[ch]);
+    free(l);
+}
+
+void loudness_analyze(void* handle, struct stream* s)
+{
+    struct loudness* l = handle;
+    const float* right = s->buffer[s->channels == 1 ? 0 : 1];
+
+    for (long pos = 0; pos < s->frames;) {
+        long frames = MIN(s->frames - pos, l->step_frames - l->step_pos);
+        kfilter(l, s->buffer[0] + pos, right + pos, frames);
+        pos         += frames;
+        l->step_pos += frames;
+        if (l->step_pos == l->step_frames)
+            finish_step(l);
+    }
+
+    // flush tiny filter states, they would decay into denormals during silence
+    for (int i = 0; i < 8; i++) {
+        double* z = &l->state[0][0][0] + i;
+        if (fabs(*z) < 1e-15)
+            *z = 0;
+    }
+
+    if (s->frames > l->tp_frames) {
+        for (int ch = 0; ch < l->channels; ch++) {
+            l->tp_buffer[ch] = util_realloc(l->tp_buffer[ch], (TP_HISTORY + s->frames) * sizeof (float));
+            if (!l->tp_frames)
+                memset(l->tp_buffer[ch], 0, TP_HISTORY * sizeof (float));
+        }
+        l->tp_frames = s->frames;
+    }
+    for (int ch = 0; ch < l->channels; ch++) {
+        float* buffer = l->tp_buffer[ch];
+        memcpy(buffer + TP_HISTORY, s->buffer[ch], s->frames * sizeof (float));
+        l->peak = true_peak(l, buffer + TP_HISTORY, s->frames, l->peak);
+        memmove(buffer, buffer + s->frames, TP_HISTORY * sizeof (float));
+    }
+}
+
+float loudness_integrated(void* handle)
+{
+    struct loudness* l = handle;
+    long    count   = 0;
+    double  energy  = 0;
+    for (int i = histogram_gate(&l->momentary, REL_GATE); i < HIST_SIZE; i++) {
+        count  += l->momentary.count[i];
+        energy += l->momentary.energy[i];
+    }
+    return count ? (float)energy_to_lufs(energy / count) : (float)ABS_GATE;
+}
+
+float loudness_range(void* handle)
+{
+    struct loudness* l = handle;
+    int     gate    = histogram_gate(&l->shortterm, LRA_GATE);
+    long    count   = 0;
+    for (int i = gate; i < HIST_SIZE; i++)
+        count += l->shortterm.count[i];
+    if (!count)
+        return 0;
+
+    // 10th to 95th percentile
+    int     low     = -1;
+    int     high    = gate;
+    long    sum     = 0;
+    for (int i = gate; i < HIST_SIZE; i++) {
+        sum += l->shortterm.count[i];
+        if (low < 0 && sum > count * 0.1)
+            low = i;
+        if (sum <= count * 0.95)
+            high = i + 1;
+    }
+    return (float)(MAX(0, MIN(high, HIST_SIZE - 1) - low) * HIST_STEP);
+}
+
+float loudness_true_peak(void* handle)
+{
+    struct loudness* l = handle;
+    return 20 * log10f(MAX(l->peak, 1e-10f));
+}
@@ -0,0 +1,35 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include "util.h"
+
+/*  loudness analysis according to ITU-R BS.1770-4 and EBU R128
+ *  loudness_init
+ *      returns a handle that must be freed with loudness_free, or NULL on error
+ *  loudness_analyze
+ *      feeds all frames of <s>, can be called with streams of any length
+ *  loudness_integrated
+ *      integrated loudness in LUFS, -70 if there's nothing above the absolute gate
+ *  loudness_range
+ *      loudness range (LRA) in LU
+ *  loudness_true_peak
+ *      maximum of the 4x oversampled signal in dBTP
+ */
+void*   loudness_init(int channels, int samplerate);
+void    loudness_free(void* handle);
+void    loudness_analyze(void* handle, struct stream* s);
+float   loudness_integrated(void* handle);
+float   loudness_range(void* handle);
+float   loudness_true_peak(void* handle);
+
+#endif // LOUDNESS_H
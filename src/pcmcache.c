@@ -0,0 +1,561 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+/*
+    cache files are a header followed by interleaved 32 bit float samples, all in native
+    byte order. they're written to <key>.pcm.tmp first and renamed when complete. the
+    modification time is updated on every hit, so the oldest file is the least recently
+    used one.
+
+    the cast thread only copies the samples into a queue, a writer thread does the file
+    io and the eviction. if the disk can't keep up the recording is dropped.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "log.h"
+#include "settings.h"
+#include "effects.h"
+#include "pcmcache.h"
+
+#define CACHE_MAGIC     "DSPC"
+#define CACHE_VERSION   1
+#define CACHE_EXT       ".pcm"
+#define TEMP_EXT        ".tmp"
+#define MAX_QUEUED      (32 * 1024 * 1024)  // bytes waiting for the writer
+#define PLAY_SLOTS      4096
+
+struct header {
+    char        magic[4];
+    int32_t     version;
+    int32_t     samplerate;
+    int32_t     channels;
+    int32_t     flags;
+    int32_t     reserved;
+    int64_t     frames;
+    char        codec[16];
+};
+
+struct reader {
+    struct mapping  map;
+    struct header   header;
+    long            current_frame;
+};
+
+struct block {
+    struct block*   next;
+    long            size;
+    float           data[];
+};
+
+// a recording, shared by the recorder and the writer thread. once released the recorder
+// doesn't touch it anymore and the writer frees it when the queue is empty.
+struct job {
+    struct job*     next;
+    char*           name;
+    char*           temp_name;
+    FILE*           file;           // only used by the writer
+    struct header   header;
+    struct block*   first;
+    struct block*   last;
+    long            queued;
+    bool            complete;       // end of stream was reached
+    bool            released;
+    bool            failed;
+};
+
+struct recorder {
+    struct decoder  inner;
+    void*           resampler;
+    struct stream   input;
+    struct job*     job;            // NULL when not recording
+    long long       size;
+    int             samplerate;
+};
+
+// played songs by cache key, a collision just forgets a song
+struct plays {
+    uint64_t        key;
+    int             count;
+};
+
+struct entry {
+    char*   name;
+    time_t  mtime;
+    long    size;
+};
+
+// everything that changes the decoded samples, the rest of the config is applied later
+static const char* key_options[] = {"bass_inter", "bass_ramp", "bass_mode", "bass_prescan", "bass_no_prescan",
+                                    "length", "cue_in"};
+
+static long             hits;
+static long             misses;
+static struct plays     plays[PLAY_SLOTS];      // only used by the loader thread
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond = PTHREAD_COND_INITIALIZER;
+static bool             running;
+static struct job*      jobs;
+
+static uint64_t hash_str(uint64_t h, const char* str)
+{
+    // FNV-1a, the 0 terminator is included so "ab","c" and "a","bc" differ
+    do {
+        h ^= (unsigned char)*str;
+        h *= 0x100000001b3ull;
+    } while (*str++);
+    return h;
+}
+
+static char* cache_name(const char* path, const char* options, int samplerate, uint64_t* key)
+{
+    struct stat st      = {0};
+    char        tmp[64] = {0};
+    uint64_t    h       = 0xcbf29ce484222325ull;
+
+    if (!settings_cache_dir || stat(path, &st) || !S_ISREG(st.st_mode))
+        return NULL;
+    h = hash_str(h, path);
+    snprintf(tmp, sizeof tmp, "%lld %lld %d", (long long)st.st_size, (long long)st.st_mtime, samplerate);
+    h = hash_str(h, tmp);
+    for (int i = 0; i < COUNT(key_options); i++) {
+        keyval_str(tmp, sizeof tmp, options, key_options[i], "");
+        h = hash_str(h, tmp);
+    }
+
+    char* name = malloc(strlen(settings_cache_dir) + 32);
+    sprintf(name, "%s/%016llx" CACHE_EXT, settings_cache_dir, (unsigned long long)h);
+    if (key)
+        *key = h;
+    return name;
+}
+
+static int compare_entries(const void* a, const void* b)
+{
+    time_t ta = ((const struct entry*)a)->mtime;
+    time_t tb = ((const struct entry*)b)->mtime;
+    return (ta > tb) - (ta < tb);
+}
+
+static void evict(void)
+{
+    DIR*            dir     = opendir(settings_cache_dir);
+    struct entry*   entries = NULL;
+    int             count   = 0;
+    int             max     = 0;
+    long long       total   = 0;
+    long long       limit   = settings_cache_size * 1024LL * 1024LL;
+    struct dirent*  de      = NULL;
+
+    if (!dir)
+        return;
+    while ((de = readdir(dir))) {
+        size_t len = strlen(de->d_name);
+        if (len < strlen(CACHE_EXT) || strcmp(de->d_name + len - strlen(CACHE_EXT), CACHE_EXT))
+            continue;
+        struct stat st = {0};
+        char* name = malloc(strlen(settings_cache_dir) + len + 2);
+        sprintf(name, "%s/%s", settings_cache_dir, de->d_name);
+        if (stat(name, &st)) {
+            free(name);
+            continue;
+        }
+        if (count == max) {
+            max = MAX(64, max * 2);
+            entries = util_realloc(entries, max * sizeof *entries);
+        }
+        entries[count].name = name;
+        entries[count].mtime = st.st_mtime;
+        entries[count].size = st.st_size;
+        total += st.st_size;
+        count++;
+    }
+    closedir(dir);
+
+    qsort(entries, count, sizeof *entries, compare_entries);
+    for (int i = 0; i < count; i++) {
+        if (total > limit && !remove(entries[i].name)) {
+            LOG_DEBUG("[pcmcache] evicted %s", entries[i].name);
+            total -= entries[i].size;
+        }
+        free(entries[i].name);
+    }
+    free(entries);
+}
+
+//-----------------------------------------------------------------------------
+
+static void reader_decode(struct decoder* dec, struct stream* s, int frames)
+{
+    struct reader* r = dec->handle;
+    int ch = r->header.channels;
+    frames = CLAMP(0, r->header.frames - r->current_frame, frames);
+    void* data = (char*)r->map.data + sizeof r->header + r->current_frame * ch * sizeof (float);
+    s->frames = 0;
+    stream_append_convert(s, &data, SF_FLOAT32I, frames, ch);
+    r->current_frame += frames;
+    s->end_of_stream = r->current_frame >= r->header.frames;
+}
+
+static void reader_seek(struct decoder* dec, long position)
+{
+    struct reader* r = dec->handle;
+    r->current_frame = CLAMP(0, position, r->header.frames);
+}
+
+static void reader_info(struct decoder* dec, struct info* info)
+{
+    struct reader* r = dec->handle;
+    memset(info, 0, sizeof *info);
+    info->codec         = r->header.codec;
+    info->frames        = r->header.frames;
+    info->channels      = r->header.channels;
+    info->samplerate    = r->header.samplerate;
+    info->flags         = r->header.flags | INFO_SEEKABLE;
+}
+
+static char* reader_metadata(struct decoder* dec, const char* key)
+{
+    return NULL;
+}
+
+static void reader_free(struct decoder* dec)
+{
+    struct reader* r = dec->handle;
+    util_unmap_file(&r->map);
+    free(r);
+    memset(dec, 0, sizeof *dec);
+}
+
+bool pcmcache_load(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    struct reader*  r       = calloc(1, sizeof *r);
+    char*           name    = cache_name(path, options, samplerate, NULL);
+    const struct header* h  = NULL;
+
+    if (!name || !util_map_file(&r->map, name) || r->map.size < (long)sizeof *h)
+        goto error;
+    h = r->map.data;
+    if (memcmp(h->magic, CACHE_MAGIC, 4) || h->version != CACHE_VERSION || h->samplerate != samplerate
+        || h->channels < 1 || h->channels > 2 || h->frames < 0
+        || r->map.size != (long)sizeof *h + h->frames * h->channels * (long)sizeof (float)) {
+        LOG_WARN("[pcmcache] %s is broken", name);
+        remove(name);
+        goto error;
+    }
+
+    r->header = *h;
+    r->header.codec[sizeof r->header.codec - 1] = 0;
+    utime(name, NULL);
+    hits++;
+    LOG_INFO("[pcmcache] hit '%s' (%ld hits, %ld misses)", path, hits, misses);
+    free(name);
+
+    dec->free       = reader_free;
+    dec->seek       = reader_seek;
+    dec->info       = reader_info;
+    dec->metadata   = reader_metadata;
+    dec->decode     = reader_decode;
+    dec->handle     = r;
+    return true;
+
+error:
+    if (name) {
+        misses++;
+        LOG_INFO("[pcmcache] miss '%s' (%ld hits, %ld misses)", path, hits, misses);
+    }
+    util_unmap_file(&r->map);
+    free(r);
+    free(name);
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+// writer thread, lock must not be held
+static void job_write(struct job* job, struct block* b)
+{
+    bool ok = job->file;
+    if (!ok) {
+        // the recorder counts frames in the header while the song plays
+        pthread_mutex_lock(&lock);
+        struct header header = job->header;
+        pthread_mutex_unlock(&lock);
+        ok = (job->file = fopen(job->temp_name, "wb")) && fwrite(&header, sizeof header, 1, job->file) == 1;
+    }
+    ok = ok && fwrite(b->data, b->size, 1, job->file) == 1;
+    if (!ok) {
+        LOG_WARN("[pcmcache] can't write %s", job->temp_name);
+        pthread_mutex_lock(&lock);
+        job->failed = true;
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+// writer thread, the job is not in the list anymore
+static void job_finish(struct job* job)
+{
+    bool ok = job->complete && !job->failed && job->file && !fseek(job->file, 0, SEEK_SET)
+        && fwrite(&job->header, sizeof job->header, 1, job->file) == 1;
+    if (job->file && fclose(job->file))
+        ok = false;
+    if (ok)
+        ok = !rename(job->temp_name, job->name);
+    if (ok) {
+        LOG_DEBUG("[pcmcache] saved %s", job->name);
+        evict();
+    } else {
+        if (job->complete && !job->failed)
+            LOG_WARN("[pcmcache] can't write %s", job->name);
+        remove(job->temp_name);
+    }
+    free(job->name);
+    free(job->temp_name);
+    free(job);
+}
+
+static void* writer_thread(void* data)
+{
+    pthread_mutex_lock(&lock);
+    while (true) {
+        struct job** link = &jobs;
+        while (*link && !(*link)->first && !(*link)->released)
+            link = &(*link)->next;
+        if (!*link) {
+            pthread_cond_wait(&cond, &lock);
+            continue;
+        }
+
+        struct job* job = *link;
+        struct block* b = job->first;
+        if (b) {
+            job->first = b->next;
+            if (!job->first)
+                job->last = NULL;
+            job->queued -= b->size;
+            bool failed = job->failed;
+            pthread_mutex_unlock(&lock);
+            if (!failed)
+                job_write(job, b);
+            free(b);
+        } else {
+            *link = job->next;
+            pthread_mutex_unlock(&lock);
+            job_finish(job);
+        }
+        pthread_mutex_lock(&lock);
+    }
+    return NULL;
+}
+
+// hands the job over to the writer for good
+static void recorder_release(struct recorder* r, bool complete)
+{
+    if (!r->job)
+        return;
+    pthread_mutex_lock(&lock);
+    r->job->complete = complete;
+    r->job->released = true;
+    pthread_cond_signal(&cond);
+    pthread_mutex_unlock(&lock);
+    r->job = NULL;
+}
+
+static void recorder_write(struct recorder* r, struct stream* s)
+{
+    int     ch      = s->channels;
+    long    size    = s->frames * ch * sizeof (float);
+    long long limit = settings_cache_size * 1024LL * 1024LL;
+
+    r->size += size;
+    if (ch != r->job->header.channels || sizeof r->job->header + r->size > limit) {
+        LOG_DEBUG("[pcmcache] not caching %s", r->job->name);
+        recorder_release(r, false);
+        return;
+    }
+
+    struct block* b = malloc(sizeof *b + size);
+    if (!b) {
+        recorder_release(r, false);
+        return;
+    }
+    b->next = NULL;
+    b->size = size;
+    float* out = b->data;
+    for (long i = 0; i < s->frames; i++)
+        for (int c = 0; c < ch; c++)
+            *out++ = s->buffer[c][i];
+
+    pthread_mutex_lock(&lock);
+    struct job* job = r->job;
+    bool drop = job->failed || job->queued + size > MAX_QUEUED;
+    if (!drop) {
+        if (job->last)
+            job->last->next = b;
+        else
+            job->first = b;
+        job->last = b;
+        job->queued += size;
+        job->header.frames += s->frames;
+        pthread_cond_signal(&cond);
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (drop) {
+        LOG_WARN("[pcmcache] can't keep up writing %s", job->name);
+        free(b);
+        recorder_release(r, false);
+    }
+}
+
+static void recorder_decode(struct decoder* dec, struct stream* s, int frames)
+{
+    struct recorder* r = dec->handle;
+    if (r->resampler) {
+        r->inner.decode(&r->inner, &r->input, frames);
+        fx_resample(r->resampler, &r->input, s);
+    } else {
+        r->inner.decode(&r->inner, s, frames);
+    }
+    if (r->job)
+        recorder_write(r, s);
+    if (r->job && s->end_of_stream)
+        recorder_release(r, true);
+}
+
+// the cached song must be the whole song, after a seek it isn't
+static void recorder_seek(struct decoder* dec, long position)
+{
+    struct recorder* r = dec->handle;
+    struct info info = {0};
+    recorder_release(r, false);
+    r->inner.info(&r->inner, &info);
+    r->inner.seek(&r->inner, (double)position * info.samplerate / r->samplerate);
+}
+
+static void recorder_info(struct decoder* dec, struct info* info)
+{
+    struct recorder* r = dec->handle;
+    r->inner.info(&r->inner, info);
+    if (info->frames > 0 && info->frames != LONG_MAX)
+        info->frames = (double)info->frames * r->samplerate / info->samplerate;
+    info->samplerate = r->samplerate;
+}
+
+static char* recorder_metadata(struct decoder* dec, const char* key)
+{
+    struct recorder* r = dec->handle;
+    return r->inner.metadata(&r->inner, key);
+}
+
+static void recorder_free(struct decoder* dec)
+{
+    struct recorder* r = dec->handle;
+    recorder_release(r, false);
+    if (r->inner.free)
+        r->inner.free(&r->inner);
+    fx_resample_free(r->resampler);
+    stream_free(&r->input);
+    free(r);
+    memset(dec, 0, sizeof *dec);
+}
+
+// modules are expensive to render and cached right away, other songs once they were
+// played often enough. that keeps the rotation from pushing everything out.
+static bool admit(uint64_t key, int flags)
+{
+    struct plays* p = &plays[key % PLAY_SLOTS];
+    if (p->key != key) {
+        p->key = key;
+        p->count = 0;
+    }
+    p->count++;
+    return (flags & INFO_MOD) || p->count >= settings_cache_min_plays;
+}
+
+static bool start_writer(void)
+{
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_t thread = {0};
+        running = !pthread_create(&thread, NULL, writer_thread, NULL);
+        if (running)
+            pthread_detach(thread);
+        else
+            LOG_ERROR("[pcmcache] can't start thread");
+    }
+    bool started = running;
+    pthread_mutex_unlock(&lock);
+    return started;
+}
+
+void pcmcache_record(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    struct info info    = {0};
+    uint64_t    key     = 0;
+    char*       name    = cache_name(path, options, samplerate, &key);
+
+    dec->info(dec, &info);
+    if (!name || info.channels < 1 || info.channels > 2 || info.samplerate <= 0) {
+        free(name);
+        return;
+    }
+    if (!admit(key, info.flags) || !start_writer()) {
+        LOG_DEBUG("[pcmcache] not caching '%s' yet", path);
+        free(name);
+        return;
+    }
+
+    // the header is written again with the number of frames when the song is complete
+    struct job* job = calloc(1, sizeof *job);
+    job->name = name;
+    job->temp_name = malloc(strlen(name) + strlen(TEMP_EXT) + 1);
+    sprintf(job->temp_name, "%s" TEMP_EXT, name);
+    memcpy(job->header.magic, CACHE_MAGIC, 4);
+    job->header.version = CACHE_VERSION;
+    job->header.samplerate = samplerate;
+    job->header.channels = info.channels;
+    job->header.flags = info.flags & (INFO_MOD | INFO_AMIGAMOD);
+    snprintf(job->header.codec, sizeof job->header.codec, "%s", info.codec ? info.codec : "unknown");
+
+    pthread_mutex_lock(&lock);
+    job->next = jobs;
+    jobs = job;
+    pthread_mutex_unlock(&lock);
+
+    struct recorder* r = calloc(1, sizeof *r);
+    r->job = job;
+    r->samplerate = samplerate;
+    if (info.samplerate != samplerate)
+        r->resampler = fx_resample_init(info.channels, info.samplerate, samplerate);
+
+    r->inner = *dec;
+    dec->free       = recorder_free;
+    dec->seek       = recorder_seek;
+    dec->info       = recorder_info;
+    dec->metadata   = recorder_metadata;
+    dec->decode     = recorder_decode;
+    dec->handle     = r;
+}
+
+void pcmcache_stats(long* hits_out, long* misses_out)
+{
+    *hits_out = hits;
+    *misses_out = misses;
+}
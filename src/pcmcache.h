@@ -0,0 +1,35 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef PCMCACHE_H
+#define PCMCACHE_H
+
+#include "util.h"
+
+/*  on disk cache of decoded and resampled songs in settings_cache_dir. the oldest files are
+ *  removed when it grows beyond settings_cache_size megabytes. a cached song depends on the
+ *  file, its size and modification time, the decoder <options> and the <samplerate>.
+ *  pcmcache_load
+ *      loads the cached version of <path> if there is one. the decoder plays from cue_in
+ *      to the end of the song, the cue_in seek must be skipped.
+ *  pcmcache_record
+ *      wraps <dec>, which must not have decoded anything except for the cue_in seek. its
+ *      output is resampled to <samplerate> and saved in the cache once the end of stream
+ *      is reached. the info of the decoder changes to the new samplerate. modules are
+ *      recorded right away, other songs after settings_cache_min_plays plays. <dec> is
+ *      left alone if the song is not recorded.
+ *  pcmcache_stats
+ *      number of hits and misses of pcmcache_load so far
+ */
+bool    pcmcache_load(struct decoder* dec, const char* path, const char* options, int samplerate);
+void    pcmcache_record(struct decoder* dec, const char* path, const char* options, int samplerate);
+void    pcmcache_stats(long* hits, long* misses);
+
+#endif // PCMCACHE_H
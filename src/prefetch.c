@@ -0,0 +1,147 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#define _GNU_SOURCE     // syscall
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "log.h"
+#include "util.h"
+#include "prefetch.h"
+
+#define CHUNK_SIZE      (1024 * 1024)
+
+static pthread_mutex_t  lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   cond = PTHREAD_COND_INITIALIZER;
+static bool             running;
+static char*            pending;        // waiting for the thread
+static long             pending_limit;
+static char*            current;        // being read or already read
+static bool             done;           // current was read completely
+static long             hits;
+static long             misses;
+static char             chunk[CHUNK_SIZE];
+
+static void lower_priority(void)
+{
+#ifdef __linux__
+    // on linux the nice value is per thread, the io priority follows it unless set otherwise
+    setpriority(PRIO_PROCESS, syscall(SYS_gettid), 19);
+#endif
+}
+
+// the data is thrown away, this is only about getting it into the page cache. network file
+// systems often ignore the fadvise hint, that's why the file is read as well.
+static bool read_file(const char* path, long limit)
+{
+    long    total   = 0;
+    bool    stop    = false;
+    int     fd      = open(path, O_RDONLY);
+
+    if (fd < 0) {
+        LOG_DEBUG("[prefetch] can't open '%s'", path);
+        return false;
+    }
+    posix_fadvise(fd, 0, limit, POSIX_FADV_WILLNEED);
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    while (total < limit) {
+        pthread_mutex_lock(&lock);
+        stop = pending;     // don't bother with the rest, something else is needed next
+        pthread_mutex_unlock(&lock);
+        if (stop)
+            break;
+        ssize_t n = read(fd, chunk, MIN(CHUNK_SIZE, limit - total));
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            stop = true;
+        if (n <= 0)
+            break;
+        total += n;
+    }
+    close(fd);
+    LOG_DEBUG("[prefetch] read %ld bytes of '%s'", total, path);
+    return !stop;
+}
+
+static void* prefetch_thread(void* data)
+{
+    lower_priority();
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (!pending)
+            pthread_cond_wait(&cond, &lock);
+        free(current);
+        current = pending;
+        pending = NULL;
+        done = false;
+        long limit = pending_limit;
+        pthread_mutex_unlock(&lock);
+
+        // current is only changed by this thread, it's safe to use without lock
+        bool complete = read_file(current, limit);
+
+        pthread_mutex_lock(&lock);
+        done = complete;
+    }
+    return NULL;
+}
+
+bool prefetch_start(const char* path, long limit)
+{
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_t thread = {0};
+        running = !pthread_create(&thread, NULL, prefetch_thread, NULL);
+        if (running)
+            pthread_detach(thread);
+        else
+            LOG_ERROR("[prefetch] can't start thread");
+    }
+    if (running) {
+        free(pending);
+        pending = util_strdup(path);
+        pending_limit = limit;
+        pthread_cond_signal(&cond);
+    }
+    bool started = running;
+    pthread_mutex_unlock(&lock);
+    return started;
+}
+
+bool prefetch_check(const char* path)
+{
+    pthread_mutex_lock(&lock);
+    bool hit = current && done && !strcmp(current, path);
+    if (hit)
+        hits++;
+    else
+        misses++;
+    long h = hits;
+    long m = misses;
+    pthread_mutex_unlock(&lock);
+    LOG_INFO("[prefetch] %s '%s' (%ld hits, %ld misses)", hit ? "hit" : "miss", path, h, m);
+    return hit;
+}
+
+void prefetch_stats(long* hits_out, long* misses_out)
+{
+    pthread_mutex_lock(&lock);
+    *hits_out = hits;
+    *misses_out = misses;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,31 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stdbool.h>
+
+/*  reads files into the page cache on a low priority background thread, so opening
+ *  them later doesn't have to wait for slow storage
+ *  prefetch_start
+ *      starts reading up to <limit> bytes of <path>, replaces a prefetch that is still
+ *      running. returns false if the thread could not be started
+ *  prefetch_check
+ *      call this when <path> is opened. counts a hit if <path> was prefetched completely,
+ *      otherwise a miss. a prefetch that is still running keeps going. returns true on hit
+ *  prefetch_stats
+ *      number of hits and misses so far
+ */
+bool    prefetch_start(const char* path, long limit);
+bool    prefetch_check(const char* path);
+void    prefetch_stats(long* hits, long* misses);
+
+#endif
@@ -8,28 +8,41 @@
 *   copyright MMXIII by maep
 */
 
+#define _FILE_OFFSET_BITS 64     // wav files over 2 GB on 32 bit systems
+
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdint.h>
 #include <limits.h>
-#include <getopt.h>
+#include <float.h>
+#include <math.h>
+#include <pthread.h>
+#ifdef __SSE2__
+    #include <emmintrin.h>
+#endif
 #include <replay_gain.h>
-#include "bassdecoder.h"
+#include "decoder.h"
 #include "ffdecoder.h"
 #include "effects.h"
+#include "log.h"
+#include "loudness.h"
+#include "scan.h"
 #include "util.h"
 
 #define MAX_LENGTH      3600     // abort scan if track is too long, in seconds
 #define SAMPLERATE      44100
-static const char* HELP_MESSAGE =
-    "demosauce scan tool 0.4.0"ID_STR"\n"
-    "syntax: scan [options] file\n"
-    "   -h                      print help\n"
-    "   -r                      disable replaygain analysis\n"
-    "   -o file.wav, stdout     write to wav or stdout\n"
-    "                           format is 16 bit, 44.1 khz, stereo\n"
-    "                           stdout is raw data, and has no wav header";
-
+#define SEGMENT_MIN     60       // minimum length of a parallel analysis segment, in seconds
+#define WARMUP_TIME     0.5      // decoded before a segment to settle the filters, in seconds
+#define REGION_TIME     3        // length of a region analyzed for an estimate, in seconds
+#define REGION_MIN      4        // minimum number of regions for an estimate
+#define LOOP_TIME       0.05     // tail length used for loopiness, in seconds
+#define SILENCE_LEVEL   -60      // quieter samples at the start and end are silence, in dBFS
+#define CUE_BLOCK       64
+#define CUE_TAIL        10       // end of a file that is searched first for cue out, in seconds
+#define WAVE_VERSION    1
+#define WRITE_BUFFER    (1 << 20)   // output buffer, in bytes
+#define WAV_HEADER      80
 // for some formats avcodec fails to provide a bitrate so I just
 // make an educated guess. if the file contains large amounts of
 // other data besides music, this will be completely wrong.
@@ -39,158 +52,907 @@ static float fake_bitrate(const char* path, float duration)
     return (size * 8) / (duration * 1000);
 }
 
-void die(const char* msg)
-{
-    puts(msg);
-    exit(EXIT_FAILURE);
-}
-
-static void mwav_write_int(FILE* f, int v, int size)
+// the wav header has a JUNK chunk that reserves space for the ds64 chunk, so files that
+// grow over 4 GB can be turned into RF64 when they are closed
+static void mwav_write_int(FILE* f, uint64_t v, int size)
 {
-    unsigned char buf[4] = {v & 255, (v >> 8) & 255, (v >> 16) & 255, (v >> 24) & 255};
+    unsigned char buf[8] = {0};
+    for (int i = 0; i < size; i++)
+        buf[i] = (v >> (i * 8)) & 255;
     fwrite(buf, 1, size, f);
 }
 
-static FILE* mwav_open_writer(const char* path, int channels, int samplerate, int samplesize)
+static bool mwav_write_header(FILE* f, int channels, int samplerate, int samplesize, bool is_float, uint64_t data_size)
 {
-    FILE* f = fopen(path, "wb");
-    if (!f)
-        return NULL;
-    fwrite("RIFF", 1, 4, f);
-    mwav_write_int(f, 0, 4);            /* filled by close */
+    bool rf64 = data_size > UINT32_MAX - WAV_HEADER;
+    fwrite(rf64 ? "RF64" : "RIFF", 1, 4, f);
+    mwav_write_int(f, rf64 ? UINT32_MAX : data_size + WAV_HEADER - 8, 4);
     fwrite("WAVE", 1, 4, f);
+    fwrite(rf64 ? "ds64" : "JUNK", 1, 4, f);
+    mwav_write_int(f, 28, 4);
+    mwav_write_int(f, rf64 ? data_size + WAV_HEADER - 8 : 0, 8);
+    mwav_write_int(f, rf64 ? data_size : 0, 8);
+    mwav_write_int(f, rf64 ? data_size / (channels * samplesize) : 0, 8);
+    mwav_write_int(f, 0, 4);
     fwrite("fmt ", 1, 4, f);
     mwav_write_int(f, 16, 4);
-    mwav_write_int(f, samplesize == 4 ? 3: 1, 2);
+    mwav_write_int(f, is_float ? 3 : 1, 2);
     mwav_write_int(f, channels, 2);
     mwav_write_int(f, samplerate, 4);
     mwav_write_int(f, channels * samplerate * samplesize, 4);
     mwav_write_int(f, channels * samplesize, 2);
     mwav_write_int(f, samplesize * 8, 2);
     fwrite("data", 1, 4, f);
-    mwav_write_int(f, 0, 4);            /* filled by close */
-    if (ftell(f) == 44)
-        return f;
-    fclose(f);
-    return NULL;
+    mwav_write_int(f, rf64 ? UINT32_MAX : data_size, 4);
+    return !ferror(f) && ftell(f) == WAV_HEADER;
 }
 
-static void mwav_close_writer(FILE* f)
+//-----------------------------------------------------------------------------
+
+// output is always stereo. samples are converted into a large buffer that is written in
+// one go when it's full, for stdout that means a few big writes into the pipe.
+struct writer {
+    FILE*           file;
+    bool            wav;
+    bool            failed;
+    bool            dither;
+    enum pcm_format format;
+    int             samplesize;
+    unsigned char*  buffer;
+    long            size;           // bytes in buffer
+    uint64_t        data_size;      // bytes written to file
+    uint32_t        seed[4];        // dither noise, one generator per lane
+};
+
+static bool writer_open(struct writer* w, const char* path, enum pcm_format format, bool dither)
 {
-    if (!f)
-        return;
-    int size = (int)ftell(f);
-    if (size < 0)
-        size = INT_MAX;
-    fseek(f, 4, SEEK_SET);
-    mwav_write_int(f, size - 8, 4);
-    fseek(f, 40, SEEK_SET);
-    mwav_write_int(f, size - 44, 4);
-    fclose(f);
-}
-
-static void write_wav(FILE* f, struct stream* s)
-{
-    int16_t tmp[128];
-    int frames = 0;
-    while (frames < s->frames) {
-        int process_frames = CLAMP(0, s->frames - frames, COUNT(tmp) / 2);
-        const float* left  = s->buffer[0] + frames;
-        const float* right = s->buffer[s->channels == 1 ? 0 : 1] + frames;
-        for (int i = 0; i < process_frames; i++) {
-            tmp[i * 2]     = CLAMP(INT16_MIN, left[i]  * INT16_MAX, INT16_MAX);
-            tmp[i * 2 + 1] = CLAMP(INT16_MIN, right[i] * INT16_MAX, INT16_MAX);
-        }
-        fwrite(tmp, sizeof (int16_t), process_frames * 2, f);
-        frames += process_frames;
-    }
-}
-
-int main(int argc, char** argv)
-{
-    const char*     path        = NULL;
-    bool            analyze     = true;
-    bool            loaded      = false;
-    struct info     info        = {0};
-    struct decoder  decoder     = {0};
-    void*           resampler   = NULL;
-    struct stream   stream0     = {{0}};
-    struct stream   stream1     = {{0}};
-    struct stream*  stream      = &stream0;
-    FILE*           output      = NULL;
-
-#ifdef ENABLE_BASS
-    if (!bass_loadso())
-        die("failed to load libbass.so");
+    const uint32_t seed[4] = {0x12345678, 0x9abcdef1, 0x0fedcba9, 0x87654321};
+    memset(w, 0, sizeof *w);
+    memcpy(w->seed, seed, sizeof seed);
+    w->format       = format;
+    w->samplesize   = format == PCM_S16 ? 2 : format == PCM_S24 ? 3 : 4;
+    w->dither       = dither && format != PCM_F32;
+    w->buffer       = util_malloc(WRITE_BUFFER);
+    w->wav          = strcmp(path, "stdout");
+    w->file         = w->wav ? fopen(path, "wb") : stdout;
+    if (!w->file || !w->buffer)
+        goto error;
+    if (w->wav && !mwav_write_header(w->file, 2, SAMPLERATE, w->samplesize, format == PCM_F32, 0))
+        goto error;
+    return true;
+
+error:
+    if (w->file && w->wav)
+        fclose(w->file);
+    free(w->buffer);
+    memset(w, 0, sizeof *w);
+    return false;
+}
+
+static void writer_flush(struct writer* w)
+{
+    if (fwrite(w->buffer, 1, w->size, w->file) != (size_t)w->size)
+        w->failed = true;
+    w->data_size += w->size;
+    w->size = 0;
+}
+
+// returns false if anything went wrong while writing
+static bool writer_close(struct writer* w)
+{
+    writer_flush(w);
+    if (w->wav) {
+        fseek(w->file, 0, SEEK_SET);
+        if (!mwav_write_header(w->file, 2, SAMPLERATE, w->samplesize, w->format == PCM_F32, w->data_size))
+            w->failed = true;
+        if (fclose(w->file))
+            w->failed = true;
+    } else if (fflush(w->file)) {
+        w->failed = true;
+    }
+    free(w->buffer);
+    return !w->failed;
+}
+
+static float noise(uint32_t* seed)
+{
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return (float)(*seed >> 8) / (1 << 24) - 0.5f;
+}
+
+#ifdef __SSE2__
+// xorshift in each lane, returns uniform noise in [-0.5, 0.5)
+static __m128 noise_sse(__m128i* seed)
+{
+    __m128i x = *seed;
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+    *seed = x;
+    __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(x, 8));
+    return _mm_sub_ps(_mm_mul_ps(f, _mm_set1_ps(1.f / (1 << 24))), _mm_set1_ps(0.5f));
+}
 #endif
-    if (argc <= 1)
-        die(HELP_MESSAGE);
-
-    char c = 0;
-    while ((c = getopt(argc, argv, "hro:-:")) != -1) {
-        switch (c) {
-        default:
-        case '?':
-            die(HELP_MESSAGE);
-        case 'h':
-            puts(HELP_MESSAGE);
-            return EXIT_SUCCESS;
-        case 'r':
-            analyze = false;
-            break;
-        case 'o':
-            if (!strcmp(optarg, "stdout")) {
-                output = stdout;
-                analyze = false;
-            } else {
-                output = mwav_open_writer(optarg, 2, SAMPLERATE, 2);
+
+// converts to interleaved integers, the sum of two noise values gives triangular dither
+static void convert_int(struct writer* w, const float* left, const float* right, long frames, unsigned char* out)
+{
+    const float max = w->format == PCM_S16 ? INT16_MAX : 8388607;
+    int16_t*    out16 = (int16_t*)out;
+    long        i = 0;
+#ifdef __SSE2__
+    const __m128 scale  = _mm_set1_ps(max);
+    const __m128 lo     = _mm_set1_ps(-max - 1);
+    const __m128 hi     = _mm_set1_ps(max);
+    __m128i     seed    = _mm_loadu_si128((const __m128i*)w->seed);
+    int32_t     tmp[2][4];
+    for (; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_mul_ps(_mm_loadu_ps(left + i), scale);
+        __m128 r = _mm_mul_ps(_mm_loadu_ps(right + i), scale);
+        if (w->dither) {
+            l = _mm_add_ps(l, _mm_add_ps(noise_sse(&seed), noise_sse(&seed)));
+            r = _mm_add_ps(r, _mm_add_ps(noise_sse(&seed), noise_sse(&seed)));
+        }
+        __m128i li = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(l, lo), hi));
+        __m128i ri = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(r, lo), hi));
+        if (w->format == PCM_S16) {
+            __m128i p = _mm_packs_epi32(li, ri);
+            _mm_storeu_si128((__m128i*)(out16 + i * 2), _mm_unpacklo_epi16(p, _mm_srli_si128(p, 8)));
+        } else {
+            _mm_storeu_si128((__m128i*)tmp[0], li);
+            _mm_storeu_si128((__m128i*)tmp[1], ri);
+            for (int k = 0; k < 4; k++) {
+                unsigned char* o = out + (i + k) * 6;
+                o[0] = tmp[0][k];
+                o[1] = tmp[0][k] >> 8;
+                o[2] = tmp[0][k] >> 16;
+                o[3] = tmp[1][k];
+                o[4] = tmp[1][k] >> 8;
+                o[5] = tmp[1][k] >> 16;
             }
-            break;
-        case '-':   // backwards compatible flag with 3.x, deprecated
-            if (!strcmp(optarg, "no-replaygain"))
-                analyze = false;
-            else
-                die(HELP_MESSAGE);
-            break;
-        };
+        }
+    }
+    _mm_storeu_si128((__m128i*)w->seed, seed);
+#endif
+    for (; i < frames; i++) {
+        float l = left[i] * max;
+        float r = right[i] * max;
+        if (w->dither) {
+            l += noise(w->seed) + noise(w->seed);
+            r += noise(w->seed) + noise(w->seed);
+        }
+        int32_t li = lrintf(CLAMP(-max - 1, l, max));
+        int32_t ri = lrintf(CLAMP(-max - 1, r, max));
+        if (w->format == PCM_S16) {
+            out16[i * 2]     = li;
+            out16[i * 2 + 1] = ri;
+        } else {
+            unsigned char* o = out + i * 6;
+            o[0] = li;
+            o[1] = li >> 8;
+            o[2] = li >> 16;
+            o[3] = ri;
+            o[4] = ri >> 8;
+            o[5] = ri >> 16;
+        }
+    }
+}
+
+static void convert_float(const float* left, const float* right, long frames, float* out)
+{
+    long i = 0;
+#ifdef __SSE2__
+    for (; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+#endif
+    for (; i < frames; i++) {
+        out[i * 2]     = left[i];
+        out[i * 2 + 1] = right[i];
+    }
+}
+
+static void writer_write(struct writer* w, struct stream* s)
+{
+    const float*    left        = s->buffer[0];
+    const float*    right       = s->buffer[s->channels == 1 ? 0 : 1];
+    long            frame_size  = 2 * w->samplesize;
+    long            pos         = 0;
+    while (pos < s->frames) {
+        long frames = MIN(s->frames - pos, (WRITE_BUFFER - w->size) / frame_size);
+        if (frames <= 0) {
+            writer_flush(w);
+            continue;
+        }
+        if (w->format == PCM_F32)
+            convert_float(left + pos, right + pos, frames, (float*)(w->buffer + w->size));
+        else
+            convert_int(w, left + pos, right + pos, frames, w->buffer + w->size);
+        w->size += frames * frame_size;
+        pos     += frames;
+    }
+}
+
+// what I'm doing here is keep the last 50 ms of a track and return the average positive value
+// of the mono mix. a module that ends in silence has a value close to zero, one that is cut
+// off at its loop point has not. the tail is kept during the main decode pass.
+struct tail {
+    float*  buffer;
+    long    size;
+    long    pos;
+    long    frames;
+};
+
+static void tail_init(struct tail* t, int samplerate)
+{
+    t->size     = MAX(1, (long)(samplerate * LOOP_TIME));
+    t->buffer   = calloc(t->size, sizeof (float));
+    t->pos      = 0;
+    t->frames   = 0;
+}
+
+static void tail_append(struct tail* t, struct stream* s)
+{
+    const float* left  = s->buffer[0];
+    const float* right = s->buffer[s->channels == 1 ? 0 : 1];
+    for (long i = MAX(0, s->frames - t->size); i < s->frames; i++) {
+        // clipped like the 16 bit mono render the value used to come from
+        t->buffer[t->pos] = CLAMP(-1.f, (left[i] + right[i]) / 2, 1.f);
+        t->pos = (t->pos + 1) % t->size;
+    }
+    t->frames = MIN(t->size, t->frames + s->frames);
+}
+
+static float tail_loopiness(struct tail* t)
+{
+    double accu = 0;
+    for (long i = 0; i < t->frames; i++)
+        accu += fabsf(t->buffer[i]);
+    return t->frames ? (float)(accu / t->frames) : 0;
+}
+
+// cue points mark where a track first and last rises above SILENCE_LEVEL. the stream is
+// checked in blocks, only the block with the transition is looked at sample by sample.
+struct cue {
+    float   level;
+    long    pos;        // frames seen so far
+    long    in;         // -1 until sound was found
+    long    out;
+};
+
+// returns the index of the first or last sample above <level>, or -1
+static long find_sound(const float* samples, long frames, float level, bool reverse)
+{
+    for (long n = 0; n < frames; n += CUE_BLOCK) {
+        long size  = MIN(CUE_BLOCK, frames - n);
+        long start = reverse ? frames - n - size : n;
+        if (fx_peak(samples + start, size) <= level)
+            continue;
+        for (long i = 0; i < size; i++) {
+            long k = reverse ? start + size - 1 - i : start + i;
+            if (fabsf(samples[k]) > level)
+                return k;
+        }
+    }
+    return -1;
+}
+
+static void cue_update(struct cue* c, struct stream* s)
+{
+    long first = -1;
+    long last  = -1;
+    for (int ch = 0; ch < s->channels; ch++) {
+        if (c->in < 0) {
+            long i = find_sound(s->buffer[ch], s->frames, c->level, false);
+            if (i >= 0 && (first < 0 || i < first))
+                first = i;
+        }
+        last = MAX(last, find_sound(s->buffer[ch], s->frames, c->level, true));
+    }
+    if (c->in < 0 && first >= 0)
+        c->in = c->pos + first;
+    if (last >= 0)
+        c->out = c->pos + last + 1;
+    c->pos += s->frames;
+}
+
+// hash of the decoded samples, before they are resampled. frames go round robin into four
+// lanes that are mixed independently, which is a lot faster than one long dependency chain.
+// the lane is picked by the position in the file, so the result doesn't depend on how the
+// decoder splits up the stream.
+struct audio_hash {
+    uint64_t    lane[4];
+    uint64_t    frames;
+    int         channels;
+};
+
+static uint64_t hash_mix(uint64_t h, uint64_t v)
+{
+    h ^= v * 0x9e3779b97f4a7c15ull;
+    h  = (h << 31) | (h >> 33);
+    return h * 0xbf58476d1ce4e5b9ull;
+}
+
+static uint64_t frame_bits(const float* left, const float* right, long i)
+{
+    uint32_t l, r;
+    memcpy(&l, left + i, 4);
+    memcpy(&r, right + i, 4);
+    return l | (uint64_t)r << 32;
+}
+
+static void hash_init(struct audio_hash* h)
+{
+    for (int i = 0; i < 4; i++)
+        h->lane[i] = i + 1;
+    h->frames   = 0;
+    h->channels = 0;
+}
+
+static void hash_update(struct audio_hash* h, struct stream* s)
+{
+    const float*    left    = s->buffer[0];
+    const float*    right   = s->buffer[s->channels == 1 ? 0 : 1];
+    long            i       = 0;
+    h->channels = s->channels;
+    for (; i < s->frames && (h->frames + i) & 3; i++)
+        h->lane[(h->frames + i) & 3] = hash_mix(h->lane[(h->frames + i) & 3], frame_bits(left, right, i));
+    uint64_t a = h->lane[0], b = h->lane[1], c = h->lane[2], d = h->lane[3];
+    for (; i + 4 <= s->frames; i += 4) {
+        a = hash_mix(a, frame_bits(left, right, i));
+        b = hash_mix(b, frame_bits(left, right, i + 1));
+        c = hash_mix(c, frame_bits(left, right, i + 2));
+        d = hash_mix(d, frame_bits(left, right, i + 3));
     }
-    path = argv[optind];
+    h->lane[0] = a;
+    h->lane[1] = b;
+    h->lane[2] = c;
+    h->lane[3] = d;
+    for (; i < s->frames; i++)
+        h->lane[(h->frames + i) & 3] = hash_mix(h->lane[(h->frames + i) & 3], frame_bits(left, right, i));
+    h->frames += s->frames;
+}
 
-#ifdef ENABLE_BASS
-    loaded = bass_load(&decoder, path, "bass_prescan=true", SAMPLERATE);
+static uint64_t hash_final(struct audio_hash* h, int samplerate)
+{
+    uint64_t v = hash_mix(h->frames, (uint64_t)samplerate << 8 | h->channels);
+    for (int i = 0; i < 4; i++)
+        v = hash_mix(v, h->lane[i]);
+    v ^= v >> 33;
+    v *= 0xff51afd7ed558ccdull;
+    v ^= v >> 33;
+    return v;
+}
+
+// the waveform summary has a 20 byte header: "DSWF", version, samplerate, frames per point
+// and number of points as 32 bit little endian. it's followed by min, max and rms of each
+// point as signed bytes, scaled by 127. all channels go into the same point.
+struct waveform {
+    long            frames_per_point;
+    long            pos;        // frames in the current point
+    int             channels;
+    float           min;
+    float           max;
+    float           sum_sq;
+    struct buffer   data;
+};
+
+static void wave_stats(const float* samples, long frames, float* min, float* max, float* sum_sq)
+{
+    float   lo  = *min;
+    float   hi  = *max;
+    float   sq  = 0;
+    long    i   = 0;
+#ifdef __SSE2__
+    __m128  vlo = _mm_set1_ps(lo);
+    __m128  vhi = _mm_set1_ps(hi);
+    __m128  vsq = _mm_setzero_ps();
+    float   tmp[3][4];
+    for (; i + 4 <= frames; i += 4) {
+        __m128 v = _mm_loadu_ps(samples + i);
+        vlo = _mm_min_ps(vlo, v);
+        vhi = _mm_max_ps(vhi, v);
+        vsq = _mm_add_ps(vsq, _mm_mul_ps(v, v));
+    }
+    _mm_storeu_ps(tmp[0], vlo);
+    _mm_storeu_ps(tmp[1], vhi);
+    _mm_storeu_ps(tmp[2], vsq);
+    lo = MIN(MIN(tmp[0][0], tmp[0][1]), MIN(tmp[0][2], tmp[0][3]));
+    hi = MAX(MAX(tmp[1][0], tmp[1][1]), MAX(tmp[1][2], tmp[1][3]));
+    sq = (tmp[2][0] + tmp[2][1]) + (tmp[2][2] + tmp[2][3]);
 #endif
-    if (!loaded)
-        loaded = ff_load(&decoder, path);
+    for (; i < frames; i++) {
+        lo = MIN(lo, samples[i]);
+        hi = MAX(hi, samples[i]);
+        sq += samples[i] * samples[i];
+    }
+    *min = lo;
+    *max = hi;
+    *sum_sq += sq;
+}
+
+static void wave_point(struct waveform* w)
+{
+    struct buffer* b = &w->data;
+    if (b->size + 3 > b->max_size) {
+        long size = b->size;
+        buffer_resize(b, MAX(4096, b->max_size * 2));
+        b->size = size;
+    }
+    int8_t* point = (int8_t*)b->data + b->size;
+    point[0] = CLAMP(-127, lrintf(w->min * 127), 127);
+    point[1] = CLAMP(-127, lrintf(w->max * 127), 127);
+    point[2] = CLAMP(0, lrintf(sqrtf(w->sum_sq / (w->pos * w->channels)) * 127), 127);
+    b->size += 3;
+    // min and max start out empty, a point of only positive samples has a positive min
+    w->pos      = 0;
+    w->min      = FLT_MAX;
+    w->max      = -FLT_MAX;
+    w->sum_sq   = 0;
+}
+
+static void wave_update(struct waveform* w, struct stream* s)
+{
+    w->channels = s->channels;
+    for (long pos = 0; pos < s->frames;) {
+        long frames = MIN(s->frames - pos, w->frames_per_point - w->pos);
+        for (int ch = 0; ch < s->channels; ch++)
+            wave_stats(s->buffer[ch] + pos, frames, &w->min, &w->max, &w->sum_sq);
+        pos    += frames;
+        w->pos += frames;
+        if (w->pos == w->frames_per_point)
+            wave_point(w);
+    }
+}
+
+static void write_int(unsigned char* buf, int v)
+{
+    buf[0] = v & 255;
+    buf[1] = (v >> 8) & 255;
+    buf[2] = (v >> 16) & 255;
+    buf[3] = (v >> 24) & 255;
+}
+
+static void wave_header(struct waveform* w, int samplerate, unsigned char* header)
+{
+    memcpy(header, "DSWF", 4);
+    write_int(header + 4, WAVE_VERSION);
+    write_int(header + 8, samplerate);
+    write_int(header + 12, w->frames_per_point);
+    write_int(header + 16, w->data.size / 3);
+}
+
+static void print_base64(FILE* out, const unsigned char* data, long size)
+{
+    static const char* digits = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for (long i = 0; i < size; i += 3) {
+        unsigned char in[3] = {0};
+        for (int k = 0; k < 3 && i + k < size; k++)
+            in[k] = data[i + k];
+        char chars[4] = {
+            digits[in[0] >> 2],
+            digits[((in[0] & 3) << 4) | (in[1] >> 4)],
+            i + 1 < size ? digits[((in[1] & 15) << 2) | (in[2] >> 6)] : '=',
+            i + 2 < size ? digits[in[2] & 63] : '='
+        };
+        fwrite(chars, 1, 4, out);
+    }
+}
+
+// progress is reported by the calling thread only. other threads just watch cancel.
+struct progress {
+    scan_progress_cb    callback;
+    void*               user;
+    volatile bool       cancel;
+};
+
+// returns false if the scan was cancelled
+static bool progress_update(struct progress* p, double value)
+{
+    if (p->callback && !p->cancel && !p->callback(p->user, CLAMP(0, value, 1)))
+        p->cancel = true;
+    return !p->cancel;
+}
+
+// decoder_load serializes backends that aren't thread safe. library users don't call
+// bass_loadso, if it's missing only avcodec and plugins are used. seek_index makes avcodec
+// decode formats it can build an index for.
+static bool load_decoder(struct decoder* decoder, const char* path, bool seek_index)
+{
+    const char* options = seek_index ? "bass_prescan=true\nfast_open=false\nseek_index=true" :
+        "bass_prescan=true\nfast_open=false";
+    return decoder_load(decoder, path, options, SAMPLERATE);
+}
+
+// replaygain is a histogram of 50 ms rms windows, so a file can be cut into segments that
+// are analyzed independently and merged afterwards. each segment starts on a window
+// boundary and decodes WARMUP_TIME of audio in front of it to get the filters into the
+// same state as a serial run. the result only differs if the decoder's seek is off, which
+// double counts or skips a few windows at the segment borders.
+struct segment {
+    struct decoder*     decoder;
+    struct decoder      own_decoder;
+    struct rg_context*  ctx;
+    struct progress*    progress;
+    bool                report;     // only the first segment runs on the calling thread
+    pthread_t           thread;
+    long                warmup;     // frames decoded before start
+    long                start;      // first analyzed frame
+    long                end;        // one past the last analyzed frame
+    long                frames;     // analyzed frames
+};
 
-    if (!loaded)
-        die("unknown format");
+static void* analyze_segment(void* data)
+{
+    struct segment* seg = data;
+    struct stream   s   = {{0}};
+    long            pos = seg->start - seg->warmup;
+
+    if (pos > 0)
+        seg->decoder->seek(seg->decoder, pos);
+    while (!s.end_of_stream && pos < seg->end && !seg->progress->cancel) {
+        long stop = pos < seg->start ? seg->start : seg->end;
+        seg->decoder->decode(seg->decoder, &s, MIN(stop - pos, SAMPLERATE));
+        float* buff[2] = {s.buffer[0], s.buffer[1]};
+        rg_analyze(seg->ctx, buff, s.frames & -2);
+        if (pos >= seg->start)
+            seg->frames += s.frames;
+        pos += s.frames;
+        if (pos == seg->start)
+            rg_discard(seg->ctx);
+        if (seg->report)
+            progress_update(seg->progress, (double)(pos - seg->start) / (seg->end - seg->start));
+    }
+    stream_free(&s);
+    return NULL;
+}
+
+// returns the number of analyzed frames, or -1 if the file is not split
+static long analyze_parallel(struct decoder* decoder, struct info* info, struct rg_context* ctx, const char* path, int threads, struct progress* progress)
+{
+    struct segment  segs[SCAN_MAX_THREADS]  = {{0}};
+    long            align                   = 2 * ((info->samplerate + 19) / 20);
+    long            frames                  = 0;
+    int             n                       = MIN(threads, info->frames / (SEGMENT_MIN * info->samplerate));
+
+    if (n < 2)
+        return -1;
+
+    // the decoders are opened here, some avcodec versions have no thread safe open
+    long seglen = (info->frames / n + align - 1) / align * align;
+    for (int i = 0; i < n; i++) {
+        struct segment* seg = segs + i;
+        seg->decoder    = i ? &seg->own_decoder : decoder;
+        seg->ctx        = i ? rg_new(info->samplerate, RG_FLOAT32, info->channels, false) : ctx;
+        seg->progress   = progress;
+        seg->report     = i == 0;
+        seg->start      = i * seglen;
+        seg->end        = (i == n - 1) ? MAX_LENGTH * info->samplerate + 1 : seg->start + seglen;
+        seg->warmup     = MIN(seg->start, (long)(WARMUP_TIME * info->samplerate) & -2);
+        if (i && (!seg->ctx || !load_decoder(seg->decoder, path, false))) {
+            n = i + 1;
+            goto error;
+        }
+    }
+
+    for (int i = 1; i < n; i++)
+        pthread_create(&segs[i].thread, NULL, analyze_segment, segs + i);
+    analyze_segment(segs);
+    for (int i = 1; i < n; i++) {
+        pthread_join(segs[i].thread, NULL);
+        rg_merge(ctx, segs[i].ctx);
+    }
+    for (int i = 0; i < n; i++)
+        frames += segs[i].frames;
+
+error:
+    for (int i = 1; i < n; i++) {
+        if (segs[i].ctx)
+            rg_free(segs[i].ctx);
+        if (segs[i].own_decoder.free)
+            segs[i].own_decoder.free(&segs[i].own_decoder);
+    }
+    return frames ? frames : -1;
+}
+
+// estimate replaygain from evenly spaced regions. the even and odd regions are also
+// analyzed on their own, the difference of both halves is a rough measure of how much the
+// estimate depends on where the regions were placed. it gets large for tracks with uneven
+// loudness, those should get a full scan later.
+// returns the number of analyzed frames, or -1 if the whole file should be analyzed
+static long analyze_estimate(struct decoder* decoder, struct info* info, struct rg_context* ctx, float fraction, float* uncertainty, struct progress* progress)
+{
+    struct stream       s           = {{0}};
+    struct rg_context*  region_ctx  = NULL;
+    struct rg_context*  half_ctx[2] = {NULL, NULL};
+    long                align       = 2 * ((info->samplerate + 19) / 20);
+    long                region      = (REGION_TIME * info->samplerate + align - 1) / align * align;
+    long                warmup      = (long)(WARMUP_TIME * info->samplerate) & -2;
+    long                frames      = -1;
+    int                 n           = MAX(REGION_MIN, (int)ceil(fraction * info->frames / region));
+
+    if (fraction >= 1 || info->frames <= 0 || (long)n * (region + warmup) >= info->frames)
+        return -1;
+    region_ctx  = rg_new(info->samplerate, RG_FLOAT32, info->channels, false);
+    half_ctx[0] = rg_new(info->samplerate, RG_FLOAT32, info->channels, false);
+    half_ctx[1] = rg_new(info->samplerate, RG_FLOAT32, info->channels, false);
+    if (!region_ctx || !half_ctx[0] || !half_ctx[1])
+        goto error;
+
+    frames = 0;
+    for (int i = 0; i < n; i++) {
+        if (!progress_update(progress, (double)i / n)) {
+            frames = -1;
+            goto error;
+        }
+        long start  = ((info->frames - region) * (2 * i + 1) / (2 * n)) / align * align;
+        long end    = start + region;
+        long pos    = MAX(0, start - warmup);
+        decoder->seek(decoder, pos);
+        s.end_of_stream = false;
+        while (!s.end_of_stream && pos < end) {
+            long stop = pos < start ? start : end;
+            decoder->decode(decoder, &s, MIN(stop - pos, SAMPLERATE));
+            float* buff[2] = {s.buffer[0], s.buffer[1]};
+            rg_analyze(region_ctx, buff, s.frames & -2);
+            if (pos >= start)
+                frames += s.frames;
+            pos += s.frames;
+            if (pos == start)
+                rg_discard(region_ctx);
+        }
+        rg_merge(ctx, region_ctx);
+        rg_merge(half_ctx[i & 1], region_ctx);
+        rg_discard(region_ctx);
+    }
+
+    *uncertainty = fabsf(rg_title_gain(half_ctx[0]) - rg_title_gain(half_ctx[1])) / 2;
+
+error:
+    for (int i = 0; i < 2; i++)
+        if (half_ctx[i])
+            rg_free(half_ctx[i]);
+    if (region_ctx)
+        rg_free(region_ctx);
+    stream_free(&s);
+    return frames;
+}
+
+// sampled and parallel analysis don't see every frame. the cue points are found by decoding
+// from the start until there is sound, and from further and further back from the end until
+// there is sound again. returns false if cancelled.
+static bool cue_seek(struct decoder* decoder, struct info* info, struct cue* c, struct progress* progress)
+{
+    struct stream s = {{0}};
+
+    c->pos = 0;
+    c->in  = -1;
+    decoder->seek(decoder, 0);
+    while (c->in < 0 && !s.end_of_stream && !progress->cancel) {
+        decoder->decode(decoder, &s, SAMPLERATE);
+        cue_update(c, &s);
+    }
+
+    // the length may be off, the end is where the decoder stops
+    for (long back = CUE_TAIL * info->samplerate; !s.end_of_stream && !progress->cancel; back *= 2) {
+        long start = MAX(c->pos, info->frames - back);
+        struct cue tail = {c->level, start, -1, 0};
+        decoder->seek(decoder, start);
+        s.end_of_stream = false;
+        while (!s.end_of_stream && !progress->cancel) {
+            decoder->decode(decoder, &s, SAMPLERATE);
+            cue_update(&tail, &s);
+        }
+        if (tail.in >= 0)
+            c->out = tail.out;
+        if (tail.in >= 0 || start == c->pos)
+            break;
+        s.end_of_stream = false;
+    }
+    stream_free(&s);
+    return !progress->cancel;
+}
+
+int scan_api_version(void)
+{
+    return SCAN_API_VERSION;
+}
+
+void scan_options_init(struct scan_options* opt, size_t size)
+{
+    struct scan_options defaults = {
+        .size       = MIN(size, sizeof defaults),
+        .analyze    = true,
+        .threads    = 1,
+        .fraction   = 1,
+        .format     = PCM_S16
+    };
+    memset(opt, 0, size);
+    memcpy(opt, &defaults, defaults.size);
+}
+
+// callers built against an older header have a shorter struct, the rest stays zero
+static bool copy_options(struct scan_options* out, const struct scan_options* opt)
+{
+    memset(out, 0, sizeof *out);
+    if (opt->size < offsetof(struct scan_options, analyze) + sizeof opt->analyze)
+        return false;
+    memcpy(out, opt, MIN(opt->size, sizeof *out));
+    out->size = sizeof *out;
+    return true;
+}
+
+const char* scan_analyze(const struct scan_options* user_opt, const char* path, struct scan_result** result_out)
+{
+    struct scan_options opts;
+    *result_out = NULL;
+    if (!copy_options(&opts, user_opt))
+        return "scan_options.size is not set";
+
+    const struct scan_options* opt = &opts;
+    const char*         error       = NULL;
+    struct scan_result* result      = calloc(1, sizeof *result);
+    bool                analyze     = opt->analyze;
+    struct info         info        = {0};
+    struct decoder      decoder     = {0};
+    struct rg_context*  ctx         = NULL;
+    void*               loudness    = NULL;
+    void*               resampler   = NULL;
+    struct stream       stream0     = {{0}};
+    struct stream       stream1     = {{0}};
+    struct stream*      stream      = &stream0;
+    struct stream*      rg_stream   = &stream0;
+    struct writer       writer      = {0};
+    struct writer*      output      = NULL;
+    struct tail         tail        = {0};
+    struct cue          cue         = {db_to_amp(SILENCE_LEVEL), 0, -1, 0};
+    struct waveform     wave        = {0};
+    struct audio_hash   hash;
+    struct fx_fade      fade[2];
+    int                 fades       = 0;
+    struct progress     progress    = {opt->progress, opt->user, false};
+    float               uncertainty = -1;
+    long                frames      = -1;
+    int                 threads     = CLAMP(1, opt->threads, SCAN_MAX_THREADS);
+
+    if (!result)
+        return "out of memory";
+    hash_init(&hash);
+
+    if (opt->output_path) {
+        if (!writer_open(&writer, opt->output_path, opt->format, opt->dither)) {
+            error = "failed to open output";
+            goto error;
+        }
+        output = &writer;
+    }
+
+    if (!load_decoder(&decoder, path, opt->seek_index)) {
+        error = "unknown format";
+        goto error;
+    }
 
     decoder.info(&decoder, &info);
 
-    if (info.samplerate <= 0)
-        die("bad samplerate");
+    if (info.samplerate <= 0) {
+        error = "bad samplerate";
+        goto error;
+    }
+
+    if (info.channels < 1 || info.channels > 2) {
+        error = "bad channel number";
+        goto error;
+    }
+
+    // replaygain is analyzed at the source samplerate, resampling is only needed for
+    // output or in the rare case that no filter could be set up for the samplerate
+    if (analyze) {
+        ctx = rg_new(info.samplerate, RG_FLOAT32, info.channels, false);
+        if (!ctx) {
+            ctx = rg_new(SAMPLERATE, RG_FLOAT32, info.channels, false);
+            rg_stream = &stream1;
+        }
+        if (!ctx) {
+            error = "failed to init replaygain";
+            goto error;
+        }
+    }
 
-    if (info.channels < 1 || info.channels > 2)
-        die("bad channel number");
+    if (opt->r128) {
+        loudness = loudness_init(info.channels, info.samplerate);
+        if (!loudness) {
+            error = "failed to init loudness analysis";
+            goto error;
+        }
+    }
 
-    if ((analyze || output) && info.samplerate != SAMPLERATE) {
+    if ((output || rg_stream == &stream1) && info.samplerate != SAMPLERATE) {
         resampler = fx_resample_init(info.channels, info.samplerate, SAMPLERATE);
-        if (!resampler)
-            die("failed to init resampler");
+        if (!resampler) {
+            error = "failed to init resampler";
+            goto error;
+        }
         stream = &stream1;
+    } else {
+        rg_stream = &stream0;
+    }
+
+    if (info.flags & INFO_MOD)
+        tail_init(&tail, info.samplerate);
+
+    if (opt->wave_rate > 0) {
+        wave.frames_per_point = MAX(1, lrintf(info.samplerate / opt->wave_rate));
+        wave.min = FLT_MAX;
+        wave.max = -FLT_MAX;
     }
 
-    struct rg_context* ctx = rg_new(SAMPLERATE, RG_FLOAT32, info.channels, false);
+    // a range is decoded from start to end and all values refer to it. total is the expected
+    // number of frames, it's <= 0 if unknown.
+    bool range          = opt->start > 0 || opt->duration > 0;
+    long range_start    = lrint(opt->start * info.samplerate);
+    long range_frames   = opt->duration > 0 ? lrint(opt->duration * info.samplerate) : LONG_MAX;
+    long total          = range_frames == LONG_MAX ? info.frames - range_start : MIN(range_frames, info.frames - range_start);
+    if (info.frames <= 0)
+        total = range_frames == LONG_MAX ? 0 : range_frames;
+
+    // output is always at SAMPLERATE
+    long fade_frames = total > 0 ? MIN(lrint(opt->fade * SAMPLERATE), total * SAMPLERATE / info.samplerate / 2) : 0;
+    if (output && fade_frames > 0) {
+        long end = total * SAMPLERATE / info.samplerate;
+        fx_fade_init(&fade[fades++], 0, fade_frames, 0, 1);
+        fx_fade_init(&fade[fades++], end - fade_frames, end, 1, 0);
+    }
+
+    // these need to see every frame, parallel or sampled analysis won't do. so does the
+    // audio hash, unless sampled or parallel analysis was asked for.
+    bool sampled     = analyze && (opt->fraction < 1 || threads > 1);
+    bool full_decode = loudness || tail.buffer || wave.frames_per_point || range || opt->seek_index || !sampled;
 
     // avcodec is unreliable when it comes to length, so the only way to be
     // absolutely accurate is to decode the whole stream
-    long frames = 0;
-    if (analyze || output || (info.flags & INFO_FFMPEG)) {
+    if (analyze && !full_decode && !output && !resampler && opt->fraction < 1 && (info.flags & INFO_SEEKABLE)) {
+        if (info.frames > MAX_LENGTH * info.samplerate) {
+            error = "exceeded maxium length";
+            goto error;
+        }
+        if (analyze_estimate(&decoder, &info, ctx, opt->fraction, &uncertainty, &progress) >= 0)
+            frames = info.frames;
+    }
+    if (frames < 0 && !progress.cancel && analyze && !full_decode && !output && !resampler && threads > 1 && (info.flags & INFO_SEEKABLE)) {
+        frames = analyze_parallel(&decoder, &info, ctx, path, threads, &progress);
+        if (frames > MAX_LENGTH * info.samplerate) {
+            error = "exceeded maxium length";
+            goto error;
+        }
+    }
+    // the sampled paths didn't see every frame, the cue points are looked for separately
+    if (frames >= 0 && !progress.cancel)
+        cue_seek(&decoder, &info, &cue, &progress);
+    if (frames < 0 && !progress.cancel && (analyze || full_decode || output || (info.flags & INFO_FFMPEG))) {
+        // decoders that can't seek have to skip to the start the slow way
+        if (range_start > 0 && (info.flags & INFO_SEEKABLE)) {
+            decoder.seek(&decoder, range_start);
+        } else {
+            for (long pos = 0; pos < range_start && !stream0.end_of_stream; pos += stream0.frames)
+                decoder.decode(&decoder, &stream0, MIN(range_start - pos, SAMPLERATE));
+            stream1.end_of_stream = stream0.end_of_stream;
+        }
+
+        frames = 0;
         while (!stream->end_of_stream) {
-            decoder.decode(&decoder, &stream0, SAMPLERATE);
+            decoder.decode(&decoder, &stream0, MIN(range_frames - frames, SAMPLERATE));
             frames += stream0.frames;
-            if (frames > MAX_LENGTH * info.samplerate)
-                die("exceeded maxium length");
+            if (frames >= range_frames)
+                stream0.end_of_stream = true;
+            if (frames > MAX_LENGTH * info.samplerate) {
+                error = "exceeded maxium length";
+                goto error;
+            }
 
             if (resampler)
                 fx_resample(resampler, &stream0, &stream1);
@@ -198,51 +960,204 @@ int main(int argc, char** argv)
             // there is a strange bug in the replaygain code that can cause it to report the wrong
             // value if the input buffer has an odd lenght, until the root of the cause is found,
             // this will have to do :(
-            float* buff[2] = {stream->buffer[0], stream->buffer[1]};
+            float* buff[2] = {rg_stream->buffer[0], rg_stream->buffer[1]};
             if (analyze)
-                rg_analyze(ctx, buff, stream->frames & -2);
+                rg_analyze(ctx, buff, rg_stream->frames & -2);
+            if (loudness)
+                loudness_analyze(loudness, &stream0);
+            if (tail.buffer)
+                tail_append(&tail, &stream0);
+            cue_update(&cue, &stream0);
+            hash_update(&hash, &stream0);
+            if (wave.frames_per_point)
+                wave_update(&wave, &stream0);
+
+            if (output) {
+                for (int i = 0; i < fades; i++)
+                    fx_fade(&fade[i], stream);
+                writer_write(output, stream);
+                if (output->failed)
+                    break;
+            }
 
-            if (output)
-                write_wav(output, stream);
+            if (!progress_update(&progress, total > 0 ? (double)frames / total : 0))
+                break;
         }
     }
 
-    if (output == stdout)
-        return EXIT_SUCCESS;
-    if (output)
-        mwav_close_writer(output);
+    if (progress.cancel) {
+        error = "cancelled";
+        goto error;
+    }
 
-    char* str = NULL;
-    str = decoder.metadata(&decoder, "artist");
-    if (str)
-        printf("artist:%s\n", str);
+    // the index is built by ffdecoder during the decode, a failure only means seeks stay slow
+    if (opt->seek_index && !range && (info.flags & INFO_FFMPEG) && !ff_save_index(&decoder, path))
+        LOG_DEBUG("[scan] no seek index for %s", path);
 
-    str = decoder.metadata(&decoder, "title");
-    if (str)
-        printf("title:%s\n", str);
+    if (output) {
+        bool ok = writer_close(output);
+        output = NULL;
+        if (!ok) {
+            error = "write failed";
+            goto error;
+        }
+    }
 
-    printf("type:%s\n", info.codec);
+    result->artist  = decoder.metadata(&decoder, "artist");
+    result->title   = decoder.metadata(&decoder, "title");
+    result->codec   = util_strdup(info.codec);
+    result->module  = info.flags & INFO_MOD;
 
     // ffmpeg's length is not reliable
-    float duration = (float)((info.flags & INFO_FFMPEG) ? frames : info.frames) / info.samplerate;
-    printf("length:%f\n", duration);
+    result->length = (float)((info.flags & INFO_FFMPEG) || range ? frames : info.frames) / info.samplerate;
+    result->samplerate = info.samplerate;
 
+    if (info.bitrate)
+        result->bitrate = info.bitrate;
+    else if (info.flags & INFO_FFMPEG)
+        result->bitrate = fake_bitrate(path, (range ? info.frames : frames) / info.samplerate);
+
+    result->has_replaygain = analyze;
     if (analyze)
-        printf("replaygain:%f\n", rg_title_gain(ctx));
+        result->replaygain = rg_title_gain(ctx);
+    result->replaygain_uncertainty = uncertainty;
 
-#ifdef ENABLE_BASS
-    if ((info.flags & INFO_BASS) && (info.flags & INFO_MOD))
-        printf("loopiness:%f\n", bass_loopiness(path));
-#endif
+    result->has_loudness = loudness;
+    if (loudness) {
+        result->loudness        = loudness_integrated(loudness);
+        result->loudness_range  = loudness_range(loudness);
+        result->true_peak       = loudness_true_peak(loudness);
+    }
 
-    if (info.bitrate)
-        printf("bitrate:%f\n", info.bitrate);
-    else if (info.flags & INFO_FFMPEG)
-        printf("bitrate:%f\n", fake_bitrate(path, frames / info.samplerate));
+    result->loopiness = tail.buffer ? tail_loopiness(&tail) : -1;
+
+    result->cue_in  = cue.in >= 0 ? (float)cue.in / info.samplerate : -1;
+    result->cue_out = cue.in >= 0 ? (float)cue.out / info.samplerate : -1;
 
-    if (!(info.flags & INFO_MOD))
-        printf("samplerate:%d\n", info.samplerate);
+    // only known if the whole file went through the decode loop
+    result->has_audio_hash = hash.channels && hash.frames == frames && !range;
+    if (result->has_audio_hash)
+        result->audio_hash = hash_final(&hash, info.samplerate);
 
-    return EXIT_SUCCESS;
+    if (wave.frames_per_point) {
+        if (wave.pos)
+            wave_point(&wave);
+        result->waveform = malloc(20 + wave.data.size);
+        if (!result->waveform) {
+            error = "out of memory";
+            goto error;
+        }
+        wave_header(&wave, info.samplerate, result->waveform);
+        memcpy(result->waveform + 20, wave.data.data, wave.data.size);
+        result->waveform_size = 20 + wave.data.size;
+    }
+
+    progress_update(&progress, 1);
+
+error:
+    if (output)
+        writer_close(output);
+    if (decoder.free)
+        decoder.free(&decoder);
+    if (ctx)
+        rg_free(ctx);
+    loudness_free(loudness);
+    fx_resample_free(resampler);
+    stream_free(&stream0);
+    stream_free(&stream1);
+    free(tail.buffer);
+    buffer_free(&wave.data);
+    if (error)
+        scan_result_free(result);
+    else
+        *result_out = result;
+    return error;
+}
+
+void scan_result_free(struct scan_result* result)
+{
+    if (!result)
+        return;
+    free(result->artist);
+    free(result->title);
+    free(result->codec);
+    free(result->waveform);
+    free(result);
+}
+
+void scan_print(const struct scan_result* result, FILE* out)
+{
+    if (result->artist)
+        fprintf(out, "artist:%s\n", result->artist);
+    if (result->title)
+        fprintf(out, "title:%s\n", result->title);
+    fprintf(out, "type:%s\n", result->codec);
+    fprintf(out, "length:%f\n", result->length);
+
+    if (result->has_replaygain)
+        fprintf(out, "replaygain:%f\n", result->replaygain);
+    if (result->replaygain_uncertainty >= 0)
+        fprintf(out, "replaygain_uncertainty:%f\n", result->replaygain_uncertainty);
+
+    if (result->has_loudness) {
+        fprintf(out, "loudness:%f\n", result->loudness);
+        fprintf(out, "loudness_range:%f\n", result->loudness_range);
+        fprintf(out, "true_peak:%f\n", result->true_peak);
+    }
+
+    if (result->loopiness >= 0)
+        fprintf(out, "loopiness:%f\n", result->loopiness);
+
+    if (result->cue_in >= 0) {
+        fprintf(out, "cue_in:%f\n", result->cue_in);
+        fprintf(out, "cue_out:%f\n", result->cue_out);
+    }
+
+    if (result->has_audio_hash)
+        fprintf(out, "audio_hash:%016llx\n", (unsigned long long)result->audio_hash);
+
+    if (result->waveform) {
+        fputs("waveform:", out);
+        print_base64(out, result->waveform, result->waveform_size);
+        fputs("\n", out);
+    }
+
+    if (result->bitrate)
+        fprintf(out, "bitrate:%f\n", result->bitrate);
+    if (!result->module)
+        fprintf(out, "samplerate:%d\n", result->samplerate);
 }
 
+const char* scan_file(const struct scan_options* user_opt, const char* path, FILE* out)
+{
+    struct scan_options opt;
+    struct scan_result* result = NULL;
+    if (!copy_options(&opt, user_opt))
+        return "scan_options.size is not set";
+    const char* error = scan_analyze(&opt, path, &result);
+    if (error)
+        return error;
+
+    // raw output went to stdout, there's no room for anything else
+    if (opt.output_path && !strcmp(opt.output_path, "stdout"))
+        goto error;
+
+    if (result->waveform && opt.wave_path) {
+        FILE* f = fopen(opt.wave_path, "wb");
+        bool ok = f && (long)fwrite(result->waveform, 1, result->waveform_size, f) == result->waveform_size;
+        if (f && fclose(f))
+            ok = false;
+        if (!ok) {
+            error = "failed to write waveform";
+            goto error;
+        }
+        free(result->waveform);
+        result->waveform = NULL;
+    }
+
+    scan_print(result, out);
+
+error:
+    scan_result_free(result);
+    return error;
+}
@@ -0,0 +1,104 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*  library interface of the scan tool, built as libdemosauce-scan.so. structs are only
+ *  ever extended at the end and SCAN_API_VERSION goes up when that happens. the caller
+ *  sets scan_options.size with scan_options_init, so the library knows which fields it
+ *  has. results are allocated by the library, fields the caller doesn't know about are
+ *  simply not read.
+ */
+
+#define SCAN_API_VERSION    5
+#define SCAN_MAX_THREADS    64
+
+enum pcm_format {
+    PCM_S16,
+    PCM_S24,
+    PCM_F32
+};
+
+// called with the progress from 0 to 1, return false to cancel the scan
+typedef bool (*scan_progress_cb)(void* user, float progress);
+
+struct scan_options {
+    size_t              size;           // sizeof(struct scan_options) of the caller
+    bool                analyze;        // replaygain
+    bool                r128;           // EBU R128 loudness
+    int                 threads;        // for parallel replaygain analysis
+    float               fraction;       // < 1 estimates replaygain from part of the file
+    float               wave_rate;      // waveform points per second, 0 disables it
+    const char*         wave_path;      // waveform sidecar file for scan_file, NULL prints it as base64
+    const char*         output_path;    // wav file or "stdout", may be NULL
+    enum pcm_format     format;
+    bool                dither;
+    scan_progress_cb    progress;       // may be NULL
+    void*               user;           // passed to progress
+    float               start;          // seconds, the range that is decoded and analyzed
+    float               duration;       // seconds, 0 is until the end
+    float               fade;           // seconds, fades output in at start and out at the end
+    bool                seek_index;     // save a seek index next to the file, if the codec needs one
+};
+
+// values that were not analyzed are 0, or -1 where 0 is a valid result
+struct scan_result {
+    char*           artist;         // NULL if unknown
+    char*           title;          // NULL if unknown
+    char*           codec;
+    bool            module;
+    float           length;         // seconds
+    int             samplerate;
+    float           bitrate;        // kbit/s
+    bool            has_replaygain;
+    float           replaygain;     // dB
+    float           replaygain_uncertainty;     // dB, -1 unless estimated
+    bool            has_loudness;
+    float           loudness;       // LUFS
+    float           loudness_range; // LU
+    float           true_peak;      // dBTP
+    float           loopiness;      // -1 unless it's a module
+    float           cue_in;         // seconds, -1 if the track is silent
+    float           cue_out;
+    unsigned char*  waveform;       // waveform summary with header, NULL if not requested
+    long            waveform_size;
+    bool            has_audio_hash; // set if the whole file was decoded, not with fraction or threads
+    uint64_t        audio_hash;     // of the decoded samples, same audio gives the same hash
+};
+
+/*  scan_api_version
+ *      returns SCAN_API_VERSION of the library
+ *  scan_options_init
+ *      sets the defaults and the size, <size> is sizeof(struct scan_options)
+ *  scan_analyze
+ *      scans <path> and sets <result> to a new result, which must be freed with
+ *      scan_result_free. returns NULL on success or an error message, in that case
+ *      <result> is NULL. can be called from several threads at once.
+ *  scan_result_free
+ *      frees <result>, NULL is ignored
+ *  scan_print
+ *      prints <result> as key:value lines, the output format of the scan tool
+ *  scan_file
+ *      scan_analyze and scan_print in one go, also writes the waveform sidecar file
+ */
+int         scan_api_version(void);
+void        scan_options_init(struct scan_options* opt, size_t size);
+const char* scan_analyze(const struct scan_options* opt, const char* path, struct scan_result** result);
+void        scan_result_free(struct scan_result* result);
+void        scan_print(const struct scan_result* result, FILE* out);
+const char* scan_file(const struct scan_options* opt, const char* path, FILE* out);
+
+#endif // SCAN_H
@@ -0,0 +1,181 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+// command line frontend of the scan tool, the work is done in scan.c
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <getopt.h>
+#include "bassdecoder.h"
+#include "decoder.h"
+#include "serve.h"
+#include "util.h"
+
+static const char* HELP_MESSAGE =
+    "demosauce scan tool 0.4.0"ID_STR"\n"
+    "syntax: scan [options] file\n"
+    "       scan [options] --serve port, socket\n"
+    "   -h                      print help\n"
+    "   -r                      disable replaygain analysis\n"
+    "   -l                      analyze EBU R128 loudness, range and true peak\n"
+    "                           can be combined with replaygain, needs a full decode\n"
+    "   -j threads              analyze long seekable files in parallel segments\n"
+    "                           gain differs from serial analysis by <= 0.02 dB\n"
+    "                           audio_hash is only printed without -j and -e\n"
+    "   -e fraction             estimate replaygain from a fraction (0-1) of seekable files\n"
+    "                           prints replaygain_uncertainty in dB, length is not verified\n"
+    "   -w rate                 waveform summary with rate points per second, printed\n"
+    "                           as base64 in waveform:\n"
+    "   -p file                 write the waveform summary to file instead\n"
+    "   -o file.wav, stdout     write to wav or stdout\n"
+    "                           44.1 khz stereo, sample format is set with -f\n"
+    "                           stdout is raw data, and has no wav header\n"
+    "                           files over 4 GB are written as RF64\n"
+    "   -f s16, s24, f32        output sample format, default is s16\n"
+    "   -d                      add triangular dither to integer output\n"
+    "   --start seconds         only decode from this position on, seeks if possible\n"
+    "   --duration seconds      only decode this much, all values refer to the range\n"
+    "   --fade seconds          fade the output in and out, for preview clips\n"
+    "   --seek-index            save a seek index as file.dsidx for mp3, mp2 and ac3 files,\n"
+    "                           makes seeking fast and exact. files with an index are\n"
+    "                           always decoded by avcodec, also when bass is there\n"
+    "   --plugins files         load comma separated decoder plugins\n"
+    "   --priority name=value   comma separated decoder priorities, higher goes first\n"
+    "                           bass is 10 and ffmpeg 0, plugins set their own\n"
+    "   --serve port, socket    keep running and scan files requested over a tcp port on\n"
+    "                           localhost or a unix socket. requests are lines of\n"
+    "                           \"<id> <path>\", each answered with \"<id> key:value\" lines\n"
+    "                           and \"<id> end\", or \"<id> error:message\"\n"
+    "                           -j sets the number of files scanned at once";
+
+static void die(const char* msg)
+{
+    puts(msg);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char** argv)
+{
+    struct scan_options opt;
+    bool                serve   = false;
+    int                 threads = 1;
+
+    scan_options_init(&opt, sizeof opt);
+
+#ifdef ENABLE_BASS
+    if (!bass_loadso())
+        die("failed to load libbass.so");
+#endif
+    if (argc <= 1)
+        die(HELP_MESSAGE);
+
+    // long options only, their short values are not in the option string
+    static const struct option long_options[] = {
+        {"no-replaygain",   no_argument,        NULL, 'r'}, // backwards compatible flag with 3.x, deprecated
+        {"serve",           no_argument,        NULL, 'S'},
+        {"start",           required_argument,  NULL, 'T'},
+        {"duration",        required_argument,  NULL, 'D'},
+        {"fade",            required_argument,  NULL, 'F'},
+        {"seek-index",      no_argument,        NULL, 'I'},
+        {"plugins",         required_argument,  NULL, 'P'},
+        {"priority",        required_argument,  NULL, 'R'},
+        {NULL, 0, NULL, 0}
+    };
+
+    char c = 0;
+    while ((c = getopt_long(argc, argv, "hrlj:e:w:p:o:f:d", long_options, NULL)) != -1) {
+        switch (c) {
+        default:
+        case '?':
+            die(HELP_MESSAGE);
+        case 'h':
+            puts(HELP_MESSAGE);
+            return EXIT_SUCCESS;
+        case 'r':
+            opt.analyze = false;
+            break;
+        case 'l':
+            opt.r128 = true;
+            break;
+        case 'j':
+            threads = CLAMP(1, atoi(optarg), SCAN_MAX_THREADS);
+            break;
+        case 'e':
+            opt.fraction = CLAMP(0.001, atof(optarg), 1);
+            break;
+        case 'w':
+            opt.wave_rate = atof(optarg);
+            break;
+        case 'p':
+            opt.wave_path = optarg;
+            break;
+        case 'o':
+            opt.output_path = optarg;
+            if (!strcmp(optarg, "stdout"))
+                opt.analyze = false;
+            break;
+        case 'f':
+            if (!strcmp(optarg, "s16"))
+                opt.format = PCM_S16;
+            else if (!strcmp(optarg, "s24"))
+                opt.format = PCM_S24;
+            else if (!strcmp(optarg, "f32"))
+                opt.format = PCM_F32;
+            else
+                die(HELP_MESSAGE);
+            break;
+        case 'd':
+            opt.dither = true;
+            break;
+        case 'S':
+            serve = true;
+            break;
+        case 'T':
+            opt.start = MAX(0, atof(optarg));
+            break;
+        case 'D':
+            opt.duration = MAX(0, atof(optarg));
+            break;
+        case 'F':
+            opt.fade = MAX(0, atof(optarg));
+            break;
+        case 'I':
+            opt.seek_index = true;
+            break;
+        case 'P':
+            if (!decoder_load_plugins(optarg))
+                die("failed to load plugins");
+            break;
+        case 'R':
+            if (!decoder_set_priorities(optarg))
+                die("invalid priority");
+            break;
+        };
+    }
+    if (optind >= argc)
+        die(HELP_MESSAGE);
+
+    // the server runs one file per worker, output files make no sense there
+    if (serve) {
+        if (opt.output_path || opt.wave_path)
+            die("-o and -p can't be used with --serve");
+        if (!serve_run(argv[optind], &opt, threads))
+            die("failed to start server");
+        return EXIT_SUCCESS;
+    }
+
+    opt.threads = threads;
+    const char* error = scan_file(&opt, argv[optind], stdout);
+    if (error)
+        die(error);
+
+    return EXIT_SUCCESS;
+}
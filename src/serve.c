@@ -0,0 +1,398 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+/*
+    scan server. keeps the process, libbass and avcodec loaded and answers scan
+    requests from several clients. the protocol is line based:
+
+        request:    <id> <path>\n
+        reply:      <id> key:value\n        one line for each value
+                    <id> end\n
+        or:         <id> error:message\n
+
+    clients can send as many requests as they want without waiting for replies.
+    replies come back in the order the scans finish, the id tells them apart. a client
+    can close its write side after the last request, it still gets all the replies.
+    a client that doesn't read its replies for SEND_TIMEOUT seconds is dropped.
+*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "log.h"
+#include "serve.h"
+#include "util.h"
+
+#define MAX_CLIENTS     64
+#define MAX_QUEUE       1024
+#define REQUEST_MAX     4096    // longest request line, id and path
+#define SEND_TIMEOUT    10      // seconds
+
+struct client {
+    int             fd;
+    int             refs;       // server loop and every queued or running job
+    pthread_mutex_t write_lock;
+    bool            dead;       // gone or not reading, protected by write_lock
+    char            line[REQUEST_MAX];
+    int             size;
+};
+
+struct job {
+    struct client*  client;
+    char*           id;
+    char*           path;
+};
+
+static struct job   queue[MAX_QUEUE];
+static int          queue_head;
+static int          queue_size;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  queue_cond = PTHREAD_COND_INITIALIZER;
+
+static const struct scan_options* options;
+
+static void client_release(struct client* c)
+{
+    pthread_mutex_lock(&queue_lock);
+    bool last = --c->refs == 0;
+    pthread_mutex_unlock(&queue_lock);
+    if (last) {
+        close(c->fd);
+        pthread_mutex_destroy(&c->write_lock);
+        free(c);
+    }
+}
+
+// the socket has a send timeout, so a client that doesn't read can't block a worker
+// for long. it's shut down then, which the server loop notices as well.
+static void client_send(struct client* c, const char* data, long size)
+{
+    pthread_mutex_lock(&c->write_lock);
+    while (size > 0 && !c->dead) {
+        ssize_t n = send(c->fd, data, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            LOG_WARN("[serve] client doesn't read, dropping it");
+            shutdown(c->fd, SHUT_RDWR);
+            c->dead = true;
+        }
+        if (n <= 0)
+            break;      // client went away, the server loop will notice
+        data += n;
+        size -= n;
+    }
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+static void client_kill(struct client* c)
+{
+    pthread_mutex_lock(&c->write_lock);
+    if (!c->dead)
+        shutdown(c->fd, SHUT_RDWR);
+    c->dead = true;
+    pthread_mutex_unlock(&c->write_lock);
+}
+
+static bool client_dead(struct client* c)
+{
+    pthread_mutex_lock(&c->write_lock);
+    bool dead = c->dead;
+    pthread_mutex_unlock(&c->write_lock);
+    return dead;
+}
+
+// prefixes every line of the scan result with the id, so the whole reply can be
+// sent in one go and doesn't get mixed up with replies from other workers
+static char* format_reply(const char* id, const char* result, size_t* size)
+{
+    char*   reply   = NULL;
+    FILE*   f       = open_memstream(&reply, size);
+    if (!f)
+        return NULL;
+    while (*result) {
+        const char* end = strchr(result, '\n');
+        int len = end ? end - result : (int)strlen(result);
+        fprintf(f, "%s %.*s\n", id, len, result);
+        result += end ? len + 1 : len;
+    }
+    fprintf(f, "%s end\n", id);
+    fclose(f);
+    return reply;
+}
+
+static void run_job(struct job* job)
+{
+    char*       result  = NULL;
+    size_t      size    = 0;
+    char*       reply   = NULL;
+    const char* error   = "out of memory";
+
+    FILE* f = open_memstream(&result, &size);
+    if (f) {
+        error = scan_file(options, job->path, f);
+        fclose(f);
+    }
+    if (!error)
+        reply = format_reply(job->id, result, &size);
+
+    if (reply) {
+        client_send(job->client, reply, size);
+    } else {
+        char line[256] = {0};
+        int len = snprintf(line, sizeof line, "%s error:%s\n", job->id, error ? error : "out of memory");
+        client_send(job->client, line, MIN(len, (int)sizeof line - 1));
+    }
+    LOG_DEBUG("[serve] %s %s %s", job->id, job->path, error ? error : "done");
+
+    free(result);
+    free(reply);
+}
+
+static void* worker(void* data)
+{
+    while (true) {
+        pthread_mutex_lock(&queue_lock);
+        while (!queue_size)
+            pthread_cond_wait(&queue_cond, &queue_lock);
+        struct job job = queue[queue_head];
+        queue_head = (queue_head + 1) % MAX_QUEUE;
+        queue_size--;
+        pthread_mutex_unlock(&queue_lock);
+
+        // nobody would get the reply
+        if (!client_dead(job.client))
+            run_job(&job);
+        client_release(job.client);
+        free(job.id);
+        free(job.path);
+    }
+    return NULL;
+}
+
+static void handle_request(struct client* c, char* line)
+{
+    char* id = line;
+    while (isspace((unsigned char)*id))
+        id++;
+    if (!*id)
+        return;     // empty lines are ignored
+    char* path = id;
+    while (*path && !isspace((unsigned char)*path))
+        path++;
+    if (*path)
+        *path++ = 0;
+    while (isspace((unsigned char)*path))
+        path++;
+    char* end = path + strlen(path);
+    while (end > path && isspace((unsigned char)end[-1]))
+        *--end = 0;
+
+    const char* error = NULL;
+    if (!*path)
+        error = "missing path";
+    pthread_mutex_lock(&queue_lock);
+    if (!error && queue_size == MAX_QUEUE)
+        error = "busy";
+    if (!error) {
+        struct job* job = &queue[(queue_head + queue_size) % MAX_QUEUE];
+        job->client = c;
+        job->id = util_strdup(id);
+        job->path = util_strdup(path);
+        c->refs++;
+        queue_size++;
+        pthread_cond_signal(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_lock);
+
+    if (error) {
+        char reply[REQUEST_MAX + 32] = {0};
+        int len = snprintf(reply, sizeof reply, "%s error:%s\n", id, error);
+        client_send(c, reply, MIN(len, (int)sizeof reply - 1));
+    }
+}
+
+enum read_state {
+    READ_MORE,
+    READ_EOF,       // no more requests, replies still go out
+    READ_ERROR
+};
+
+static enum read_state client_read(struct client* c)
+{
+    ssize_t n = recv(c->fd, c->line + c->size, REQUEST_MAX - c->size, 0);
+    if (n < 0 && errno == EINTR)
+        return READ_MORE;
+    if (n < 0)
+        return READ_ERROR;
+    if (n == 0) {
+        // the last request may lack the newline
+        c->line[MIN(c->size, REQUEST_MAX - 1)] = 0;
+        handle_request(c, c->line);
+        c->size = 0;
+        return READ_EOF;
+    }
+    c->size += n;
+
+    char* start = c->line;
+    char* end = NULL;
+    while ((end = memchr(start, '\n', c->line + c->size - start))) {
+        *end = 0;
+        handle_request(c, start);
+        start = end + 1;
+    }
+    c->size -= start - c->line;
+    memmove(c->line, start, c->size);
+    if (c->size == REQUEST_MAX) {
+        LOG_WARN("[serve] request too long");
+        return READ_ERROR;
+    }
+    return READ_MORE;
+}
+
+// a plain number is a tcp port on localhost, anything else is the path of a unix socket
+static int open_listener(const char* address)
+{
+    int fd = -1;
+    bool is_port = *address;
+    for (const char* c = address; *c; c++)
+        is_port = is_port && isdigit((unsigned char)*c);
+
+    if (is_port) {
+        struct sockaddr_in addr = {0};
+        int yes = 1;
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto error;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof yes);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0)
+            goto error;
+    } else {
+        struct sockaddr_un addr = {0};
+        if (strlen(address) >= sizeof addr.sun_path)
+            goto error;
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, address);
+        // a stale socket from an earlier run is removed, anything else is left alone
+        struct stat st = {0};
+        if (!lstat(address, &st)) {
+            if (!S_ISSOCK(st.st_mode)) {
+                LOG_ERROR("[serve] %s exists and is not a socket", address);
+                return -1;
+            }
+            unlink(address);
+        }
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd < 0)
+            goto error;
+        if (bind(fd, (struct sockaddr*)&addr, sizeof addr) < 0)
+            goto error;
+    }
+
+    if (listen(fd, 16) < 0)
+        goto error;
+    return fd;
+
+error:
+    LOG_ERROR("[serve] can't listen on %s (%s)", address, strerror(errno));
+    if (fd >= 0)
+        close(fd);
+    return -1;
+}
+
+bool serve_run(const char* address, const struct scan_options* opt, int workers)
+{
+    struct pollfd   fds[MAX_CLIENTS + 1];
+    struct client*  clients[MAX_CLIENTS + 1] = {NULL};
+    int             count   = 1;
+
+    options = opt;
+    fds[0].fd = open_listener(address);
+    fds[0].events = POLLIN;
+    if (fds[0].fd < 0)
+        return false;
+
+    for (int i = 0; i < workers; i++) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, worker, NULL))
+            return false;
+        pthread_detach(thread);
+    }
+    LOG_INFO("[serve] listening on %s with %d workers", address, workers);
+
+    while (true) {
+        if (poll(fds, count, -1) < 0) {
+            if (errno == EINTR)
+                continue;
+            LOG_ERROR("[serve] poll failed (%s)", strerror(errno));
+            return false;
+        }
+
+        // clients are dropped by moving the last one into their slot. the socket is
+        // closed when the last reply was sent.
+        for (int i = count - 1; i > 0; i--) {
+            if (!fds[i].revents)
+                continue;
+            enum read_state state = client_read(clients[i]);
+            if (state == READ_MORE)
+                continue;
+            LOG_DEBUG("[serve] client %s", state == READ_EOF ? "done sending" : "disconnected");
+            if (state == READ_ERROR)
+                client_kill(clients[i]);
+            client_release(clients[i]);
+            count--;
+            fds[i] = fds[count];
+            clients[i] = clients[count];
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept(fds[0].fd, NULL, NULL);
+            struct client* c = NULL;
+            if (fd >= 0 && count <= MAX_CLIENTS)
+                c = calloc(1, sizeof *c);
+            if (!c) {
+                LOG_WARN("[serve] rejected client");
+                if (fd >= 0)
+                    close(fd);
+                continue;
+            }
+            LOG_DEBUG("[serve] client connected");
+            struct timeval timeout = {SEND_TIMEOUT, 0};
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+            c->fd = fd;
+            c->refs = 1;
+            pthread_mutex_init(&c->write_lock, NULL);
+            fds[count].fd = fd;
+            fds[count].events = POLLIN;
+            fds[count].revents = 0;
+            clients[count] = c;
+            count++;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,23 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*/
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "scan.h"
+
+/*  serve_run
+ *      runs a scan server on <address>, which is a tcp port on localhost or the path of a
+ *      unix socket. <workers> files are scanned at once. only returns on error. part of
+ *      the scan tool, not the library.
+ */
+bool    serve_run(const char* address, const struct scan_options* opt, int workers);
+
+#endif // SERVE_H
@@ -33,6 +33,14 @@ void settings_init(int argc, char** argv);
     X(str, cast_description,    NULL)           \
     X(int, remote_enable,       1)              \
     X(int, remote_port,         1911)           \
+    X(int, prefetch_time,       0)              \
+    X(int, prefetch_size,       64)             \
+    X(str, cache_dir,           NULL)           \
+    X(int, cache_size,          1024)           \
+    X(int, cache_min_plays,     3)              \
+    X(int, bass_prerender,      0)              \
+    X(str, decoder_plugins,     NULL)           \
+    X(str, decoder_priority,    NULL)           \
     X(str, error_title,         "server error") \
     X(str, log_file,            "demosauce.log")\
     X(log, log_file_level,      log_info)       \
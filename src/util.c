@@ -15,18 +15,29 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <ctype.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <sys/types.h>
+#include <sys/mman.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#ifdef __linux__
+    #include <sys/vfs.h>
+#endif
 #include <netdb.h>
+#include <zlib.h>
 #include "util.h"
 #include "log.h"
 #include "effects.h"
 
 #define MEM_ALIGN       32
 #define SOCKET_BLOCK    1024
+#define ZIP_LOCAL       0x04034b50
+#define ZIP_CENTRAL     0x02014b50
+#define ZIP_END         0x06054b50
 
 void* util_malloc(size_t size)
 {
@@ -71,6 +82,240 @@ long util_filesize(const char* path)
     return size;
 }
 
+double util_time(void)
+{
+    struct timespec t = {0};
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// a mapped file that shrinks or whose server goes away raises SIGBUS on access, there's no
+// way to catch that. files on network file systems are not mapped, callers read them with
+// plain file io then.
+static bool is_remote(int fd)
+{
+#ifdef __linux__
+    struct statfs buf = {0};
+    if (fstatfs(fd, &buf))
+        return false;
+    switch ((unsigned long)buf.f_type & 0xffffffff) {
+    case 0x6969:        // nfs
+    case 0x517b:        // smb
+    case 0xff534d42:    // cifs
+    case 0xfe534d42:    // smb2
+    case 0x65735546:    // fuse, sshfs and friends
+    case 0x00c36400:    // ceph
+    case 0x01021997:    // 9p
+    case 0x5346414f:    // afs
+    case 0x0bd00bd0:    // lustre
+        return true;
+    }
+#endif
+    return false;
+}
+
+bool util_map_file(struct mapping* m, const char* path)
+{
+    struct stat buf = {0};
+    void*       data = MAP_FAILED;
+    int         fd = open(path, O_RDONLY);
+
+    memset(m, 0, sizeof *m);
+    if (fd < 0 || fstat(fd, &buf) || !S_ISREG(buf.st_mode) || buf.st_size <= 0 || buf.st_size > LONG_MAX)
+        goto error;
+    if (is_remote(fd))
+        goto error;
+    data = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+        goto error;
+
+    // the hints are only a performance thing, errors don't matter
+    posix_madvise(data, buf.st_size, POSIX_MADV_SEQUENTIAL);
+    posix_madvise(data, buf.st_size, POSIX_MADV_WILLNEED);
+    m->data = data;
+    m->size = buf.st_size;
+
+error:
+    if (fd >= 0)
+        close(fd);
+    LOG_DEBUG("[mapfile] '%s' %s", path, BOOL_STR(m->data));
+    return m->data;
+}
+
+void util_unmap_file(struct mapping* m)
+{
+    if (m->unpacked)
+        free(m->unpacked);
+    else if (m->data)
+        munmap((void*)m->data, m->size);
+    memset(m, 0, sizeof *m);
+}
+
+static unsigned long read_le(const unsigned char* p, int size)
+{
+    unsigned long value = 0;
+    while (size--)
+        value = (value << 8) | p[size];
+    return value;
+}
+
+// <size> is only a hint how much memory is needed
+static bool unpack_deflate(struct mapping* m, const void* data, long data_size, long size, long limit, int window_bits)
+{
+    z_stream        z           = {0};
+    unsigned char*  out         = NULL;
+    long            capacity    = CLAMP(64 * 1024, size, limit);
+    long            total       = 0;
+    int             err         = Z_OK;
+
+    if (data_size > UINT_MAX || inflateInit2(&z, window_bits) != Z_OK)
+        return false;
+    z.next_in = (Bytef*)data;
+    z.avail_in = data_size;
+    while (err == Z_OK) {
+        if (total == capacity) {
+            if (capacity >= limit)
+                break;
+            capacity = MIN(capacity * 2, limit);
+        }
+        unsigned char* tmp = realloc(out, capacity);
+        if (!tmp)
+            break;
+        out = tmp;
+        z.next_out = out + total;
+        z.avail_out = capacity - total;
+        err = inflate(&z, Z_NO_FLUSH);
+        total = capacity - z.avail_out;
+    }
+    inflateEnd(&z);
+
+    if (err != Z_STREAM_END) {
+        LOG_WARN("[unpack] %s", err == Z_OK ? "too large" : "broken data");
+        free(out);
+        return false;
+    }
+    m->data = m->unpacked = out;
+    m->size = total;
+    return true;
+}
+
+static bool unpack_zip(struct mapping* m, const struct mapping* zip, long limit)
+{
+    const unsigned char*    data    = zip->data;
+    long                    end     = zip->size - 22;
+    const unsigned char*    entry   = NULL;
+    unsigned long           size    = 0;
+
+    // the end of central directory record is followed by a comment of up to 64k
+    while (end >= 0 && end >= zip->size - 22 - 0xffff && read_le(data + end, 4) != ZIP_END)
+        end--;
+    if (end < 0 || read_le(data + end, 4) != ZIP_END)
+        goto error;
+
+    // look for the largest file, archives often come with a readme
+    long pos = read_le(data + end + 16, 4);
+    for (int i = read_le(data + end + 10, 2); i > 0; i--) {
+        if (pos + 46 > end || read_le(data + pos, 4) != ZIP_CENTRAL)
+            goto error;
+        long name_len = read_le(data + pos + 28, 2);
+        long entry_len = 46 + name_len + read_le(data + pos + 30, 2) + read_le(data + pos + 32, 2);
+        if (pos + entry_len > end)
+            goto error;
+        bool is_dir = name_len > 0 && data[pos + 46 + name_len - 1] == '/';
+        if (!is_dir && (!entry || read_le(data + pos + 24, 4) > size)) {
+            entry = data + pos;
+            size = read_le(entry + 24, 4);
+        }
+        pos += entry_len;
+    }
+    if (!entry)
+        goto error;
+    if (size > (unsigned long)limit) {
+        LOG_WARN("[unpack] too large");
+        return false;
+    }
+
+    int method = read_le(entry + 10, 2);
+    unsigned long crc = read_le(entry + 16, 4);
+    long packed_size = read_le(entry + 20, 4);
+    long local = read_le(entry + 42, 4);
+    if (local + 30 > zip->size || read_le(data + local, 4) != ZIP_LOCAL)
+        goto error;
+    long offset = local + 30 + read_le(data + local + 26, 2) + read_le(data + local + 28, 2);
+    if (offset + packed_size > zip->size)
+        goto error;
+
+    if (method == 0) {
+        if (packed_size != size)
+            goto error;
+        m->unpacked = malloc(MAX(1, size));
+        if (!m->unpacked)
+            return false;
+        memcpy(m->unpacked, data + offset, size);
+        m->data = m->unpacked;
+        m->size = size;
+    } else if (method != 8 || !unpack_deflate(m, data + offset, packed_size, size, limit, -MAX_WBITS)) {
+        goto error;
+    }
+    if ((unsigned long)m->size == size && crc32(0, m->data, m->size) == crc)
+        return true;
+    util_unmap_file(m);
+
+error:
+    LOG_WARN("[unpack] unsupported or broken zip file");
+    return false;
+}
+
+// files that can't be mapped are decoded with plain file io, but packed ones must be in
+// memory to be unpacked. only those are read here.
+static bool read_packed(struct mapping* m, const char* path, long limit)
+{
+    unsigned char   magic[4]    = {0};
+    unsigned char*  data        = NULL;
+    long            size        = util_filesize(path);
+    FILE*           f           = fopen(path, "rb");
+
+    if (!f || size < 22 || size > limit || fread(magic, 1, 4, f) != 4)
+        goto error;
+    if (!(magic[0] == 0x1f && magic[1] == 0x8b) && read_le(magic, 4) != ZIP_LOCAL)
+        goto error;
+    data = malloc(size);
+    if (!data || fseek(f, 0, SEEK_SET) || fread(data, 1, size, f) != (size_t)size) {
+        free(data);
+        goto error;
+    }
+    m->data = m->unpacked = data;
+    m->size = size;
+
+error:
+    if (f)
+        fclose(f);
+    return m->data;
+}
+
+bool util_load_file(struct mapping* m, const char* path, long limit)
+{
+    if (!util_map_file(m, path) && !read_packed(m, path, limit))
+        return false;
+
+    const unsigned char* data = m->data;
+    bool is_gzip = m->size >= 18 && data[0] == 0x1f && data[1] == 0x8b && data[2] == 8;
+    bool is_zip = m->size >= 22 && read_le(data, 4) == ZIP_LOCAL;
+    if (!is_gzip && !is_zip)
+        return true;
+
+    struct mapping packed = *m;
+    bool unpacked = false;
+    memset(m, 0, sizeof *m);
+    if (is_gzip) // last 4 bytes are the unpacked size modulo 2^32
+        unpacked = unpack_deflate(m, packed.data, packed.size, read_le(data + packed.size - 4, 4), limit, 16 + MAX_WBITS);
+    else
+        unpacked = unpack_zip(m, &packed, limit);
+    util_unmap_file(&packed);
+    LOG_DEBUG("[unpack] '%s' %s", path, BOOL_STR(unpacked));
+    return unpacked;
+}
+
 //-----------------------------------------------------------------------------
 
 char* util_strdup(const char* str)
@@ -19,6 +19,7 @@
 #define INFO_SEEKABLE   1
 #define INFO_FFMPEG     (1 << 1)
 #define INFO_BASS       (1 << 2)
+#define INFO_FORWARD    (1 << 3)        // can only seek forward, not set with INFO_SEEKABLE
 #define INFO_MOD        (1 << 16)
 #define INFO_AMIGAMOD   (1 << 17)
 
@@ -93,6 +94,15 @@ struct decoder {
 };
 
 
+// read only mapping of a local file
+struct mapping {
+    const void* data;
+    long        size;
+    void*       unpacked;               // set if data was unpacked into memory
+};
+
+#define UNPACK_LIMIT    (256L * 1024 * 1024)    // compressed files can't unpack to more
+
 // equivalent to stdlib functions, but memory is aligned to 32 byte boundry.
 void*   util_malloc(size_t size);
 void*   util_realloc(void* ptr, size_t size);
@@ -106,11 +116,30 @@ void*   util_realloc(void* ptr, size_t size);
  *      return true if <path> is a regular file
  *  util_filesize
  *      returns size of <path> in bytes
+ *  util_time
+ *      monotonic time in seconds, for measuring how long things take
  */
 char*   util_strdup(const char* str);
 char*   util_trim(char* str);
 bool    util_isfile(const char* path);
 long    util_filesize(const char* path);
+double  util_time(void);
+
+/*  util_map_file
+ *      maps <path> into memory and advises the os that it will be read sequentially soon.
+ *      returns false if <path> is not a regular file or can't be mapped, empty files can't.
+ *      also false for files on network file systems, a mapping raises SIGBUS when the server
+ *      goes away.
+ *  util_unmap_file
+ *      unmaps or frees <m> and sets it to zero. does nothing if <m> is not mapped.
+ *  util_load_file
+ *      same as util_map_file, but gzip files and zip archives are unpacked into memory, also
+ *      those that can't be mapped. for zip the largest file in the archive is used. returns
+ *      false if the file is larger than <limit> bytes when unpacked, or if it's broken.
+ */
+bool    util_map_file(struct mapping* m, const char* path);
+bool    util_load_file(struct mapping* m, const char* path, long limit);
+void    util_unmap_file(struct mapping* m);
 
 /*  socket_connect
  *      opens tcp socket on <host>:<port>. returns -1 on error. close with socket_close.
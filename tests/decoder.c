@@ -0,0 +1,103 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*
+*   checks that the decoder order only changes when a backend keeps failing, and that
+*   avcodec goes first for files that get a seek index
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "decoder.h"
+
+#define TEST_FILE   "decoder_test.flac"
+#define TEST_MP3    "decoder_test.mp3"
+
+static const char*  called;     // backend that tried first
+static bool         first_works;
+
+// the built in backends are replaced, bass never loads anything and ffmpeg everything
+bool bass_loadso(void) { return false; }
+bool bass_load(struct decoder* dec, const char* path, const char* options, int samplerate) { return false; }
+bool bass_probe(const char* path) { return false; }
+bool ff_load(struct decoder* dec, const char* path, const char* options)
+{
+    if (!called)
+        called = "ffmpeg";
+    return true;
+}
+bool ff_probe_name(const char* path) { return false; }
+bool ff_has_index(const char* path) { return false; }
+
+static bool load_first(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    if (!called)
+        called = "first";
+    return first_works;
+}
+
+static bool load_second(struct decoder* dec, const char* path, const char* options, int samplerate)
+{
+    if (!called)
+        called = "second";
+    return true;
+}
+
+static void check_file(const char* path, const char* options, bool works, const char* expected, int step)
+{
+    struct decoder dec = {0};
+    first_works = works;
+    called = NULL;
+    if (!decoder_load(&dec, path, options, 44100)) {
+        printf("load %d failed\n", step);
+        exit(EXIT_FAILURE);
+    }
+    if (strcmp(called, expected)) {
+        printf("load %d: %s tried first, expected %s\n", step, called, expected);
+        exit(EXIT_FAILURE);
+    }
+}
+
+static void check(bool works, const char* expected, int step)
+{
+    check_file(TEST_FILE, NULL, works, expected, step);
+}
+
+int main(void)
+{
+    static const char* formats[] = {"flac", NULL};
+    struct decoder_backend first = {"first", 100, true, NULL, load_first, formats};
+    struct decoder_backend second = {"second", 90, true, NULL, load_second, formats};
+    FILE* f = fopen(TEST_FILE, "wb");
+    FILE* mp3 = fopen(TEST_MP3, "wb");
+    if (!f || fputs("fLaC", f) < 0 || fclose(f) || !mp3 || fputs("ID3", mp3) < 0 || fclose(mp3) ||
+        !decoder_register(&first) || !decoder_register(&second)) {
+        puts("setup failed");
+        return EXIT_FAILURE;
+    }
+
+    int step = 0;
+    // a few broken files keep the order
+    for (int i = 0; i < 20; i++)
+        check(i % 5 != 2, "first", step++);
+    // the second backend needs 8 tries and a clearly better rate to go first
+    for (int i = 0; i < 5; i++)
+        check(false, "first", step++);
+    check(true, "second", step++);
+    check(true, "second", step++);
+
+    // nobody claims mp3 here, so the order is by priority unless an index is built
+    check_file(TEST_MP3, NULL, true, "first", step++);
+    check_file(TEST_MP3, "seek_index=true", true, "ffmpeg", step++);
+
+    remove(TEST_FILE);
+    remove(TEST_MP3);
+    puts("decoder order ok");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+/*
+*   demosauce - fancy icecast source client
+*
+*   this source is published under the GPLv3 license.
+*   http://www.gnu.org/licenses/gpl.txt
+*   also, this is beerware! you are strongly encouraged to invite the
+*   authors of this software to a beer when you happen to meet them.
+*   copyright MMXIII by maep
+*
+*   checks that seeking with avcodec lands on the same samples as decoding from the start.
+*   the files are given on the command line, make check passes SEEK_FILES.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ffdecoder.h"
+
+#define CHUNK       4096
+#define COMPARE     4096        // frames compared after each seek
+#define SEARCH      4096        // how far off a seek may be to tell by how much
+#define TOLERANCE   1e-3f       // lossy codecs don't decode bit exact from a different start
+#define POSITIONS   7
+
+struct pcm {
+    float*  data[MAX_CHANNELS];
+    long    frames;
+    int     channels;
+};
+
+// decodes up to <frames> frames, or everything if <frames> is negative
+static void pcm_decode(struct decoder* dec, struct pcm* p, long frames)
+{
+    struct stream s = {{0}};
+    p->frames = 0;
+    while (frames < 0 || p->frames < frames) {
+        dec->decode(dec, &s, CHUNK);
+        long count = frames < 0 ? s.frames : MIN(s.frames, frames - p->frames);
+        if (count > 0)
+            p->channels = s.channels;
+        for (int ch = 0; ch < p->channels && count > 0; ch++) {
+            p->data[ch] = realloc(p->data[ch], (p->frames + count) * sizeof (float));
+            memcpy(p->data[ch] + p->frames, s.buffer[ch], count * sizeof (float));
+        }
+        p->frames += count;
+        if (s.end_of_stream)
+            break;
+    }
+    stream_free(&s);
+}
+
+static void pcm_free(struct pcm* p)
+{
+    for (int ch = 0; ch < MAX_CHANNELS; ch++)
+        free(p->data[ch]);
+    memset(p, 0, sizeof *p);
+}
+
+// largest difference between <part> and <all> from <offset> on
+static float difference(struct pcm* all, struct pcm* part, long offset)
+{
+    long frames = MIN(part->frames, all->frames - offset);
+    float diff = offset < 0 || frames < part->frames ? INFINITY : 0;
+    for (int ch = 0; ch < all->channels && diff < INFINITY; ch++)
+        for (long i = 0; i < frames; i++)
+            diff = MAX(diff, fabsf(all->data[ch][offset + i] - part->data[ch][i]));
+    return diff;
+}
+
+static bool check_file(const char* path)
+{
+    struct decoder  dec     = {0};
+    struct pcm      all     = {{0}};
+    struct pcm      part    = {{0}};
+    bool            ok      = true;
+
+    if (!ff_load(&dec, path, NULL)) {
+        printf("%s: can't load\n", path);
+        return false;
+    }
+    pcm_decode(&dec, &all, -1);
+    dec.free(&dec);
+    if (all.frames < 2 * COMPARE || !ff_load(&dec, path, NULL)) {
+        printf("%s: too short or can't load\n", path);
+        pcm_free(&all);
+        return false;
+    }
+
+    // the positions are visited out of order so some seeks go backwards
+    for (int i = 0; i < POSITIONS; i++) {
+        long target = (all.frames - COMPARE) * ((i * 3) % POSITIONS + 1) / (POSITIONS + 1);
+        dec.seek(&dec, target);
+        pcm_decode(&dec, &part, COMPARE);
+        float diff = difference(&all, &part, target);
+        if (diff <= TOLERANCE)
+            continue;
+        ok = false;
+        long best = 0;
+        float best_diff = diff;
+        for (long offset = -SEARCH; offset <= SEARCH; offset++) {
+            float d = difference(&all, &part, target + offset);
+            if (d < best_diff) {
+                best = offset;
+                best_diff = d;
+            }
+        }
+        if (best_diff <= TOLERANCE)
+            printf("%s: seek to %ld is off by %ld frames\n", path, target, best);
+        else
+            printf("%s: seek to %ld doesn't match, difference %f\n", path, target, diff);
+    }
+
+    dec.free(&dec);
+    pcm_free(&all);
+    pcm_free(&part);
+    if (ok)
+        printf("%s: seek ok\n", path);
+    return ok;
+}
+
+int main(int argc, char** argv)
+{
+    bool ok = true;
+    if (argc < 2)
+        puts("no files to seek in, set SEEK_FILES");
+    for (int i = 1; i < argc; i++)
+        ok = check_file(argv[i]) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}